@@ -20,23 +20,185 @@
  *
  */
 #include "AllDiffCBS.h"
+#include "AllDiffKernel.h"
+#include "CBSThreadPool.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
 
-#include <set>
 
 /***********************************************************************************************************************
  * AllDiffCBS
  **********************************************************************************************************************/
 
-// Static variables declaration
-bool AllDiffCBS::computed = false;
-AllDiffCBS::MincFactors AllDiffCBS::mincFactors;
-AllDiffCBS::LiangBaiFactors AllDiffCBS::liangBaiFactors;
+namespace {
+    // log(n) for n >= 1. Unlike std::log, it can be evaluated at compile time to generate the factor tables.
+    constexpr double logInt(long long n) {
+        // n = m 2^k with m in [sqrt(1/2), sqrt(2)), then log(m) = 2 atanh((m - 1) / (m + 1)) from its series.
+        double m = n;
+        int k = 0;
+        while (m >= 1.4142135623730951) {
+            m /= 2;
+            k++;
+        }
+        double z = (m - 1) / (m + 1), z2 = z * z, term = z, sum = 0;
+        for (int i = 1; i < 40; i += 2) {
+            sum += term / i;
+            term *= z2;
+        }
+        return k * 0.69314718055994530942 + 2 * sum;
+    }
+
+    // log(n) for n in 1..largestDomainSize, the only logarithms the factors need
+    constexpr void fillLogs(double *logs, int largestDomainSize) {
+        for (int n = 1; n <= largestDomainSize; n++)
+            logs[n - 1] = logInt(n);
+    }
+
+    // Minc and Brégman factors log(n!) / n for n in 1..largestDomainSize
+    constexpr void fillMincFactors(double *minc, const double *logs, int largestDomainSize) {
+        // log(n!), which does not overflow like n! does past n = 170
+        double logFact = 0;
+        for (int n = 1; n <= largestDomainSize; n++) {
+            logFact += logs[n - 1];
+            minc[n - 1] = logFact / n;
+        }
+    }
+
+    // Liang and Bai factors for the domain sizes 1..largestDomainSize, one row per pair of variables (2b - 1, 2b) for b
+    // in 1..nbRows, as both variables get the same factors
+    constexpr void fillLiangBaiFactors(double *liangBai, const double *logs, int nbRows, int largestDomainSize) {
+        double *row = liangBai;
+        for (int b = 1; b <= nbRows; b++) {
+            for (int j = 1; j <= largestDomainSize; j++) {
+                int a = (j + 2) / 2;
+                int q = a < b ? a : b;
+                // log(q (j - q + 1)) as a sum, both factors being at most j
+                row[j - 1] = logs[q - 1] + logs[j - q];
+            }
+            row += largestDomainSize;
+        }
+    }
 
-AllDiffCBS::AllDiffCBS(Space &home, const IntVarArgs &x)
-        : CBSConstraint(home, x) {}
+    // Number of variables and of values covered by the factor tables generated at compile time
+    const int staticSize = 128;
+
+    // Evaluating logInt() only staticSize times and sharing the rows of Liang and Bai keeps the generation within the
+    // default constexpr step limit of clang (1048576), which staticSize² logarithms exceed.
+    struct StaticFactors {
+        static const int size = staticSize;
+        double minc[size];
+        double liangBai[size / 2 * size];
+
+        constexpr StaticFactors() : minc(), liangBai() {
+            double logs[size] = {};
+            fillLogs(logs, size);
+            fillMincFactors(minc, logs, size);
+            fillLiangBaiFactors(liangBai, logs, size / 2, size);
+        }
+    };
+
+    // Embedded read-only in the binary
+    constexpr StaticFactors staticFactors;
+}
+
+struct AllDiffCBS::DensityScratch {
+    // Extreme densities of every unassigned variable, along with the first value where they are found
+    struct VarDensities { double maxDensity; int maxVal; double minDensity; int minVal; };
+    std::vector<VarDensities> varDensities;
+    // Whether the densities of a variable come from the exact number of solutions
+    std::vector<char> exact;
+    // Whether a value (minus _minVal) is held by an assigned variable
+    std::vector<char> held;
+
+    /**
+     * Domains without the held values and the values of the saturated Hall intervals (see restrictDomains()). Every
+     * unassigned variable has its degree (number of values left) and the span of its values that are not held.
+     * Value v is in a saturated Hall interval hallLo[v]..hallHi[v] (the whole range of values if none), and only the
+     * variables whose span is in this interval can take it. Values are minus _minVal.
+     */
+    std::vector<int> degree, spanLo, spanHi, hallLo, hallHi;
+    // Whether a Hall interval restricts some values
+    bool restricted;
+    // Hall intervals search: number of values that are not held below every value, variables by span end, and the
+    // saturated intervals
+    std::vector<int> freeBefore, bySpanHi, spanLows;
+    std::vector<std::pair<int, int>> hallIntervals;
+
+    // Can the unassigned variable var take the value v (minus _minVal)
+    bool allowed(int var, int v) const {
+        return !held[v] && spanLo[var] >= hallLo[v] && spanHi[var] <= hallHi[v];
+    }
+
+    // Connected components of the unassigned variables: union-find parents, mask of the unassigned variables, and
+    // the variables of the component c in compVars[compStart[c]..compStart[c+1]-1]. compIndex is the index of a
+    // variable in its component.
+    std::vector<int> parent;
+    std::vector<unsigned long long> unassigned;
+    std::vector<int> compId, compStart, compVars, compIndex;
+
+    /**
+     * Upper bounds of every component, and change of the bounds when a value is removed from a variable, and from all
+     * the variables supporting a value. valMinc and valLiangBai have an extra last entry, -infinity, for the values
+     * a variable can not take. Values of the domain of a variable, their indices in valMinc (minus _minVal) and their
+     * bounds.
+     */
+    std::vector<double> compMinc, compLiangBai;
+    std::vector<double> varMinc, varLiangBai, valMinc, valLiangBai;
+    std::vector<int> values, vals;
+    std::vector<double> bounds;
+
+    // Exact densities: domains of the variables of a component as bit masks of value indices, index of every
+    // value (or -1), values that got an index, the forward and backward counts of the dynamic programming, the
+    // subsets of every layer and the number of solutions of every (variable, value index). The counts are all zeros
+    // between two uses.
+    std::vector<unsigned int> domMask;
+    std::vector<int> valIndex, indexedVals;
+    std::vector<double> counts, backCounts, valCount;
+    std::vector<std::vector<unsigned int>> layers;
+
+    // Best choice of every chunk of variables when they are evaluated in parallel
+    std::vector<CBSPosValDensity> chunkBest;
+
+    // Where getDensities() wants the density of every value, or null
+    std::vector<CBSPosValDensity> *table;
+    // Logarithm of the number of solutions: of the components counted by exactDensity(), and of the constraint
+    double exactLogCount;
+    double logCount;
+};
+
+AllDiffCBS::AllDiffCBS(Space &home, const IntVarArgs &x, int exactThreshold)
+        : CBSConstraint(home, x), _exactThreshold(exactThreshold), _factors(nullptr) {
+    _domSize = home.alloc<int>(_x.size());
+    for (int i = 0; i < _x.size(); i++)
+        _domSize[i] = _x[i].size();
+
+    _minVal = minDomValue();
+    _nbVal = maxDomValue() - _minVal + 1;
+    _nbWords = (_x.size() + bitsPerWord - 1) / bitsPerWord;
+    _valToVar = home.alloc<Word>(_nbVal * _nbWords);
+    std::fill(_valToVar, _valToVar + _nbVal * _nbWords, 0);
+    for (int var = 0; var < _x.size(); var++) {
+        for (Gecode::IntVarValues val((IntVar)_x[var]); val(); ++val) {
+            _valToVar[(val.val() - _minVal) * _nbWords + var / bitsPerWord] |= Word(1) << (var % bitsPerWord);
+        }
+    }
+}
 
 AllDiffCBS::AllDiffCBS(Space &home, bool share, AllDiffCBS *c)
-        : CBSConstraint(home, share, c) {}
+        : CBSConstraint(home, share, c),
+          _minVal(c->_minVal), _nbVal(c->_nbVal), _nbWords(c->_nbWords), _exactThreshold(c->_exactThreshold),
+          _factors(c->_factors) {
+    _runtimeFactors.update(home, share, c->_runtimeFactors);
+    if (_runtimeFactors.object() != nullptr)
+        // Without sharing, the copy has its own tables.
+        _factors = &*_runtimeFactors;
+    _domSize = home.alloc<int>(_x.size());
+    std::copy(c->_domSize, c->_domSize + _x.size(), _domSize);
+    _valToVar = home.alloc<Word>(_nbVal * _nbWords);
+    std::copy(c->_valToVar, c->_valToVar + _nbVal * _nbWords, _valToVar);
+}
 
 CBSConstraint *AllDiffCBS::copy(Space &home, bool share, CBSConstraint *c) {
     char *mem = home.alloc<char>(sizeof(AllDiffCBS));
@@ -44,163 +206,598 @@ CBSConstraint *AllDiffCBS::copy(Space &home, bool share, CBSConstraint *c) {
     return ret;
 }
 
-CBSPosValDensity AllDiffCBS::getDensity(std::function<bool(double,double)> comparator) const {
+CBSPosValDensity AllDiffCBS::getDensity(CBSStrategy strategy) {
     assert(!_x.assigned());
 
-    // Minc and Brégman and Liang and Bai upper bound.
-    struct UB { double minc; double liangBai; };
-    int idx = 0;
-    UB ub = std::accumulate(_x.begin(), _x.end(), UB{1, 1}, [&](UB acc, auto elem) {
-        return UB{acc.minc * mincFactors.get(elem.size()),
-                  acc.liangBai * liangBaiFactors.get(idx++, elem.size())};
-    });
+    threadScratch<DensityScratch>().table = nullptr;
+    int nbUnassigned;
+    bool allExact = prepareDensities(nbUnassigned);
+
+    switch (strategy) {
+        case MIN_BRANCHING:
+            return selectDensity<CBSMinDensity>(!allExact, nbUnassigned);
+        default:
+            // The aggregated strategies are computed by the brancher from getDensities(), on its own a constraint
+            // branches on its highest density like them.
+            return selectDensity<CBSMaxDensity>(!allExact, nbUnassigned);
+    }
+}
 
-    // Function for updating both upper bounds when a domain change.
-    auto upperBoundUpdate = [&](UB &_ub, int index, int oldDomSize, int newDomSize) {
-        _ub.minc *= mincFactors.get(newDomSize) / mincFactors.get(oldDomSize);
-        _ub.liangBai *= liangBaiFactors.get(index, newDomSize) / liangBaiFactors.get(index, oldDomSize);
-    };
+double AllDiffCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
 
-    auto minDomVal = minDomValue(); // TODO: Regarder si il n'y aurait pas une meilleur façon de faire ça
-    auto valuesSpan = maxDomValue() - minDomVal + 1;
+    auto &s = threadScratch<DensityScratch>();
+    s.table = &densities;
+    int nbUnassigned;
+    if (!prepareDensities(nbUnassigned))
+        boundDensity(s, 0, _x.size());
+    s.table = nullptr;
+    return s.logCount;
+}
 
-    // Vector that span the domain of every variables for keeping densities. There's no need to set the vector to zero
-    // at each iteration.
-    std::vector<double> densities((unsigned long)valuesSpan);
+bool AllDiffCBS::prepareDensities(int &nbUnassigned) {
+    // Value to variables incidence
+    updateDomains();
 
-    // In the main loop, for a given value, we need to know which variable can be assigned to the value. The goal of
-    // valToVar is to speed up this operation.
-    std::vector<std::set<int>> valToVar((unsigned long)valuesSpan);
-    for (int var=0; var<_x.size(); var++) {
-        for (Gecode::IntVarValues val((IntVar)_x[var]); val(); ++val) {
-            valToVar[val.val()-minDomVal].insert(var);
+    auto &s = threadScratch<DensityScratch>();
+    s.varDensities.resize(_x.size());
+    s.exact.assign(_x.size(), false);
+
+    // Values held by assigned variables. If two variables hold the same value, there is no solution left.
+    bool solvable = true;
+    nbUnassigned = 0;
+    s.held.assign(_nbVal, false);
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned()) {
+            char &held = s.held[_x[i].val() - _minVal];
+            if (held)
+                solvable = false;
+            held = true;
+        } else {
+            nbUnassigned++;
+        }
+    }
+    if (solvable)
+        solvable = restrictDomains(nbUnassigned);
+    if (!solvable) {
+        noDensity();
+        s.logCount = -std::numeric_limits<double>::infinity();
+        return true;
+    }
+
+    // The unassigned variables of different components share no value: the number of solutions is the product of
+    // the number of solutions of the components, and the densities of a variable only depend on its component. Near
+    // the leaves, the exact number of solutions of a small component is cheaper to get than its upper bounds.
+    bool allExact = true;
+    s.exactLogCount = 0;
+    int nbComponents = findComponents();
+    for (int c = 0; c < nbComponents; c++) {
+        const int *vars = &s.compVars[s.compStart[c]];
+        int nbVars = s.compStart[c + 1] - s.compStart[c];
+        if (exactDensity(vars, nbVars)) {
+            for (int k = 0; k < nbVars; k++)
+                s.exact[vars[k]] = true;
+        } else {
+            allExact = false;
         }
     }
 
-    struct { int pos; int val; double density; } choice;
-    bool first_choice = true;
+    s.logCount = s.exactLogCount;
+    if (!allExact)
+        boundFactors(nbComponents);
+    return allExact;
+}
+
+bool AllDiffCBS::restrictDomains(int nbUnassigned) const {
+    auto &s = threadScratch<DensityScratch>();
+    s.degree.assign(_x.size(), 0);
+    s.spanLo.assign(_x.size(), 0);
+    s.spanHi.assign(_x.size(), -1);
+    s.hallLo.assign(_nbVal, 0);
+    s.hallHi.assign(_nbVal, _nbVal - 1);
+    s.restricted = false;
+
+    // Span of the values that are not held
     for (int i = 0; i < _x.size(); i++) {
-        if (!_x[i].assigned()) {
-            auto varUB = ub;
-            upperBoundUpdate(varUB, i, _x[i].size(), 1); // Assignation of the variable
-            double normalization = 0; // Normalization constant for keeping all densities values between 0 and 1
-            // We calculate the density for every value assignment for the variable
-            for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
-                double *density = &densities[val.val() - minDomVal];
-                auto localUB = varUB;
-                // We update the upper bound for every variable affected by the assignation.
-                for (auto &var : valToVar[val.val() - minDomVal]) {
-                    if (var != i) {
-                        upperBoundUpdate(localUB, var, _x[var].size(), _x[var].size() - 1);
-                    }
-                }
-                auto lowerUB = std::min(localUB.minc, sqrt(localUB.liangBai));
-                *density = lowerUB;
-                normalization += lowerUB;
+        if (_x[i].assigned())
+            continue;
+        int lo = _nbVal, hi = -1;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            int v = val.val() - _minVal;
+            if (!s.held[v]) {
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
             }
+        }
+        if (hi < 0)
+            return false;
+        s.spanLo[i] = lo;
+        s.spanHi[i] = hi;
+    }
 
-            // Normalisation and choice selection
-            for (Gecode::IntVarValues val((IntVar)_x[i]); val(); ++val) {
-                double *density = &densities[val.val() - minDomVal];
-                *density /= normalization;
-                // Is this new density a better choice than our current one?
-                if (first_choice || comparator(*density, choice.density)) {
-                    choice = {i, val.val(), *density};
-                    first_choice = false;
-                }
+    /**
+     * A saturated Hall interval [a, b] holds as many values that are not held as there are variables spanning values
+     * in [a, b] only. These variables take all its values, which the other variables can not take. Overlapping
+     * saturated intervals have a saturated intersection, so a value is only restricted by the smallest interval that
+     * contains it. Intervals are searched in O(nbUnassigned^2), only for the smaller constraints.
+     */
+    if (nbUnassigned <= maxHallVariables) {
+        s.freeBefore.resize(_nbVal + 1);
+        s.freeBefore[0] = 0;
+        for (int v = 0; v < _nbVal; v++)
+            s.freeBefore[v + 1] = s.freeBefore[v] + !s.held[v];
+
+        s.bySpanHi.clear();
+        s.spanLows.clear();
+        for (int i = 0; i < _x.size(); i++) {
+            if (!_x[i].assigned()) {
+                s.bySpanHi.push_back(i);
+                s.spanLows.push_back(s.spanLo[i]);
             }
         }
+        std::sort(s.bySpanHi.begin(), s.bySpanHi.end(), [&s](int i, int j) { return s.spanHi[i] < s.spanHi[j]; });
+        std::sort(s.spanLows.begin(), s.spanLows.end());
+        s.spanLows.erase(std::unique(s.spanLows.begin(), s.spanLows.end()), s.spanLows.end());
+
+        s.hallIntervals.clear();
+        for (int a : s.spanLows) {
+            int count = 0;
+            for (int k = 0; k < (int) s.bySpanHi.size(); k++) {
+                int var = s.bySpanHi[k];
+                if (s.spanLo[var] >= a)
+                    count++;
+                // Intervals end at the end of a span, once all the variables of this end are counted
+                int b = s.spanHi[var];
+                if (b < a || (k + 1 < (int) s.bySpanHi.size() && s.spanHi[s.bySpanHi[k + 1]] == b))
+                    continue;
+                int free = s.freeBefore[b + 1] - s.freeBefore[a];
+                // More variables than values: no solution
+                if (count > free)
+                    return false;
+                if (count == free && count > 0)
+                    s.hallIntervals.push_back({a, b});
+            }
+        }
+
+        // From the largest interval to the smallest one, so every value ends up with the smallest
+        std::sort(s.hallIntervals.begin(), s.hallIntervals.end(), [](const std::pair<int, int> &p,
+                                                                      const std::pair<int, int> &q) {
+            return p.second - p.first > q.second - q.first;
+        });
+        for (const auto &h : s.hallIntervals) {
+            for (int v = h.first; v <= h.second; v++) {
+                s.hallLo[v] = h.first;
+                s.hallHi[v] = h.second;
+            }
+        }
+        s.restricted = !s.hallIntervals.empty();
     }
 
-    return CBSPosValDensity{choice.pos, choice.val, choice.density};
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val)
+            s.degree[i] += s.allowed(i, val.val() - _minVal);
+        if (s.degree[i] == 0)
+            return false;
+    }
+    return true;
 }
 
-void AllDiffCBS::precomputeDataStruct(int nbVar, int largestDomainSize) {
-    if (!computed) {
-        mincFactors = MincFactors(largestDomainSize);
-        liangBaiFactors = LiangBaiFactors(nbVar, largestDomainSize);
-        computed = true;
+void AllDiffCBS::noDensity() const {
+    auto &s = threadScratch<DensityScratch>();
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        s.exact[i] = true;
+        s.varDensities[i] = {0, _x[i].min(), 0, _x[i].min()};
+        if (s.table != nullptr)
+            for (IntVarValues val((IntVar)_x[i]); val(); ++val)
+                s.table->push_back({i, val.val(), 0});
     }
 }
 
+template<class Density>
+CBSPosValDensity AllDiffCBS::selectDensity(bool bounds, int nbUnassigned) const {
+    auto &s = threadScratch<DensityScratch>();
+    if (_threads <= 1 || nbUnassigned < parallelThreshold) {
+        if (bounds)
+            boundDensity(s, 0, _x.size());
+        return bestDensity<Density>(s, 0, _x.size());
+    }
 
-/***********************************************************************************************************************
- * MincFactors
- **********************************************************************************************************************/
+    // Every chunk of variables gets its densities and its best choice on the thread pool, from the memory of this
+    // thread (s).
+    int nbChunks = (_x.size() + parallelChunk - 1) / parallelChunk;
+    s.chunkBest.resize(nbChunks);
+    CBSThreadPool::pool().run(nbChunks, _threads, [&](int c) {
+        int begin = c * parallelChunk, end = std::min(begin + parallelChunk, _x.size());
+        if (bounds)
+            boundDensity(s, begin, end);
+        s.chunkBest[c] = bestDensity<Density>(s, begin, end);
+    });
 
-AllDiffCBS::MincFactors::MincFactors() {}
+    // Reduced in the order of the chunks, so the choice is the one of the serial computation.
+    int best = -1;
+    for (int c = 0; c < nbChunks; c++) {
+        if (s.chunkBest[c].pos >= 0 && (best < 0 || Density::better(s.chunkBest[c].density, s.chunkBest[best].density)))
+            best = c;
+    }
+    return s.chunkBest[best];
+}
 
-AllDiffCBS::MincFactors::MincFactors(int largestDomainSize)
-        : largestDomainSize(largestDomainSize) {
-    assert(!computed);
-    mincFactors = heap.alloc<double>(largestDomainSize);
-    precomputeMincFactors(largestDomainSize);
+template<class Density>
+CBSPosValDensity AllDiffCBS::bestDensity(const DensityScratch &s, int begin, int end) const {
+    CBSPosValDensity choice = {-1, 0, 0};
+    for (int i = begin; i < end; i++) {
+        if (!_x[i].assigned()) {
+            const auto &d = s.varDensities[i];
+            // Only one of the extreme densities of the variable can be a better choice than our current one.
+            bool min = Density::better(d.minDensity, d.maxDensity);
+            double density = min ? d.minDensity : d.maxDensity;
+            if (choice.pos < 0 || Density::better(density, choice.density))
+                choice = {i, min ? d.minVal : d.maxVal, density};
+        }
+    }
+    return choice;
 }
 
-AllDiffCBS::MincFactors::~MincFactors() {
-    if (computed) {
-        heap.free(mincFactors, largestDomainSize);
+int AllDiffCBS::findComponents() const {
+    /**
+     * Components are built again on every call. Unlike the bounds, they can not be updated from the previous node:
+     * they split when domains shrink, which union-find can not undo, and a new held value or Hall interval can split
+     * variables whose domains did not change. It is one pass over the incidence matrix.
+     */
+    auto &s = threadScratch<DensityScratch>();
+    s.parent.resize(_x.size());
+    s.unassigned.assign(_nbWords, 0);
+    for (int i = 0; i < _x.size(); i++) {
+        s.parent[i] = i;
+        if (!_x[i].assigned())
+            s.unassigned[i / bitsPerWord] |= Word(1) << (i % bitsPerWord);
+    }
+    auto find = [&s](int i) {
+        while (s.parent[i] != i)
+            i = s.parent[i] = s.parent[s.parent[i]];
+        return i;
+    };
+
+    // Unassigned variables that can take the same value are in the same component. A value held by an assigned
+    // variable cannot be taken by them, and the value of a saturated Hall interval only by its variables.
+    for (int v = 0; v < _nbVal; v++) {
+        if (s.held[v])
+            continue;
+        int root = -1;
+        const Word *row = &_valToVar[v * _nbWords];
+        for (int w = 0; w < _nbWords; w++) {
+            for (Word bits = row[w] & s.unassigned[w]; bits != 0; bits &= bits - 1) {
+                int var = w * bitsPerWord + __builtin_ctzll(bits);
+                if (!s.allowed(var, v))
+                    continue;
+                var = find(var);
+                if (root < 0)
+                    root = var;
+                else if (var != root)
+                    s.parent[var] = root;
+            }
+        }
+    }
+
+    // Components are numbered by their first variable, and list their variables in increasing order.
+    int nbComponents = 0;
+    s.compId.assign(_x.size(), -1);
+    for (int i = 0; i < _x.size(); i++) {
+        if (!_x[i].assigned()) {
+            int root = find(i);
+            if (s.compId[root] < 0)
+                s.compId[root] = nbComponents++;
+            s.compId[i] = s.compId[root];
+        }
+    }
+    s.compStart.assign(nbComponents + 1, 0);
+    for (int i = 0; i < _x.size(); i++)
+        if (!_x[i].assigned())
+            s.compStart[s.compId[i] + 1]++;
+    for (int c = 0; c < nbComponents; c++)
+        s.compStart[c + 1] += s.compStart[c];
+    s.compVars.resize(s.compStart[nbComponents]);
+    s.compIndex.resize(_x.size());
+    // parent is not needed anymore, it is reused as the insertion point of every component
+    std::copy(s.compStart.begin(), s.compStart.end() - 1, s.parent.begin());
+    for (int i = 0; i < _x.size(); i++) {
+        if (!_x[i].assigned()) {
+            int c = s.compId[i];
+            s.compIndex[i] = s.parent[c] - s.compStart[c];
+            s.compVars[s.parent[c]++] = i;
+        }
     }
+
+    return nbComponents;
 }
 
-double AllDiffCBS::MincFactors::get(int domSize) {
-    assert(domSize <= largestDomainSize);
-    return mincFactors[domSize - 1];
+void AllDiffCBS::boundFactors(int nbComponents) const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+    s.varMinc.resize(_x.size());
+    s.varLiangBai.resize(_x.size());
+    s.valMinc.resize(_nbVal + 1);
+    s.valLiangBai.resize(_nbVal + 1);
+    s.compMinc.assign(nbComponents, 0);
+    s.compLiangBai.assign(nbComponents, 0);
+
+    // Upper bounds of every component, from the domains left to its variables (their degree) and their index in the
+    // component
+    for (int var = 0; var < _x.size(); var++) {
+        if (_x[var].assigned() || s.exact[var])
+            continue;
+        int c = s.compId[var], index = s.compIndex[var], degree = s.degree[var];
+        s.compMinc[c] += _factors->minc(degree);
+        s.compLiangBai[c] += _factors->liangBai(index, degree);
+
+        // Change of the bounds when a value is removed from the domain of the variable. A variable losing its last
+        // value means there is no solution left.
+        if (degree > 1) {
+            s.varMinc[var] = _factors->minc(degree - 1) - _factors->minc(degree);
+            s.varLiangBai[var] = _factors->liangBai(index, degree - 1) - _factors->liangBai(index, degree);
+        } else {
+            s.varMinc[var] = s.varLiangBai[var] = -infinity;
+        }
+    }
+    for (int c = 0; c < nbComponents; c++)
+        if (!s.exact[s.compVars[s.compStart[c]]])
+            s.logCount += std::min(s.compMinc[c], 0.5 * s.compLiangBai[c]);
+
+    // Change of the bounds when a value is removed from every variable that can be assigned to it. This only depends
+    // on the value, so it is computed once instead of once per variable. The variables that can take a value are all
+    // in the same component. The Liang and Bai part is already halved (square root of the bound).
+    for (int v = 0; v < _nbVal; v++) {
+        double minc = 0, liangBai = 0;
+        const Word *row = &_valToVar[v * _nbWords];
+        for (int w = 0; w < _nbWords && !s.held[v]; w++) {
+            for (Word bits = row[w] & s.unassigned[w]; bits != 0; bits &= bits - 1) {
+                int var = w * bitsPerWord + __builtin_ctzll(bits);
+                if (s.allowed(var, v) && !s.exact[var]) {
+                    minc += s.varMinc[var];
+                    liangBai += s.varLiangBai[var];
+                }
+            }
+        }
+        s.valMinc[v] = s.held[v] ? -infinity : minc;
+        s.valLiangBai[v] = s.held[v] ? -infinity : 0.5 * liangBai;
+    }
+    s.valMinc[_nbVal] = s.valLiangBai[_nbVal] = -infinity;
 }
 
-double AllDiffCBS::MincFactors::precomputeMincFactors(int n) {
-    if (n == 1) {
-        mincFactors[0] = 1;
-        return 1;
-    } else {
-        double fact = n * precomputeMincFactors(n - 1);
-        mincFactors[n - 1] = pow(fact, 1.0 / n);
-        return fact;
+void AllDiffCBS::boundDensity(DensityScratch &s, int begin, int end) const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    // Values and bounds of a variable are kept in the memory of the thread running this, the rest is shared in s.
+    auto &own = threadScratch<DensityScratch>();
+    own.values.resize(_nbVal);
+    own.vals.resize(_nbVal);
+    own.bounds.resize(_nbVal);
+
+    // The bounds are those of the component of the variable, the other components do not change its densities.
+    for (int i = begin; i < end; i++) {
+        if (_x[i].assigned() || s.exact[i])
+            continue;
+
+        int nbVals = 0;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            int v = val.val() - _minVal;
+            own.values[nbVals] = val.val();
+            own.vals[nbVals++] = s.allowed(i, v) ? v : _nbVal;
+        }
+
+        int c = s.compId[i], index = s.compIndex[i], degree = s.degree[i];
+        if (degree == 1) {
+            // A single value left, the variable takes it in every solution.
+            int k = 0;
+            while (own.vals[k] == _nbVal)
+                k++;
+            if (s.table != nullptr)
+                for (int l = 0; l < nbVals; l++)
+                    s.table->push_back({i, own.values[l], l == k ? 1.0 : 0.0});
+            int other = k == 0 && nbVals > 1 ? 1 : 0;
+            s.varDensities[i] = {1, own.values[k], other == k ? 1.0 : 0.0, own.values[other]};
+            continue;
+        }
+
+        // Bounds once the variable is assigned. The value sums above include the variable itself, which supports all
+        // its values, so its own change is taken back here.
+        double mincShift = s.compMinc[c] + _factors->minc(1) - _factors->minc(degree) - s.varMinc[i];
+        double liangBaiShift = 0.5 * (s.compLiangBai[c] + _factors->liangBai(index, 1)
+                                      - _factors->liangBai(index, degree) - s.varLiangBai[i]);
+
+        // (Log) upper bound for every value assignment for the variable
+        auto r = AllDiffKernel::bounds(s.valMinc.data(), s.valLiangBai.data(), own.vals.data(), nbVals,
+                                       mincShift, liangBaiShift, own.bounds.data());
+
+        double maxDensity = 0, minDensity = 0, normalization = 0;
+        // If the largest bound is -inf, no value of the variable leaves a solution and all its densities are 0.
+        if (r.maxBound != -infinity) {
+            // Normalization constant for keeping all densities values between 0 and 1. The bounds are shifted by the
+            // largest one before leaving log space (log-sum-exp), so the exponentials can neither overflow nor all
+            // underflow to 0.
+            for (int k = 0; k < nbVals; k++)
+                normalization += std::exp(own.bounds[k] - r.maxBound);
+            maxDensity = 1 / normalization;
+            minDensity = std::exp(r.minBound - r.maxBound) / normalization;
+        }
+        if (s.table != nullptr) {
+            for (int k = 0; k < nbVals; k++) {
+                double density = normalization == 0 ? 0 : std::exp(own.bounds[k] - r.maxBound) / normalization;
+                s.table->push_back({i, own.values[k], density});
+            }
+        }
+        s.varDensities[i] = {maxDensity, own.values[r.argMax], minDensity, own.values[r.argMin]};
     }
 }
 
+bool AllDiffCBS::exactDensity(const int *vars, int nbVars) const {
+    if (nbVars > _exactThreshold)
+        return false;
 
-/***********************************************************************************************************************
- * LiangBaiFactors
- **********************************************************************************************************************/
+    auto &s = threadScratch<DensityScratch>();
+    if ((int) s.valIndex.size() != _nbVal)
+        s.valIndex.assign(_nbVal, -1);
+    if (s.counts.size() != size_t(1) << maxExactValues) {
+        s.counts.assign(size_t(1) << maxExactValues, 0);
+        s.backCounts.assign(size_t(1) << maxExactValues, 0);
+    }
 
-AllDiffCBS::LiangBaiFactors::LiangBaiFactors() {}
+    // Index of the values that are left for the variables, and their domains as masks of these indices
+    s.indexedVals.clear();
+    s.domMask.assign(nbVars, 0);
+    bool small = true;
+    for (int t = 0; t < nbVars && small; t++) {
+        for (IntVarValues val((IntVar)_x[vars[t]]); val(); ++val) {
+            int v = val.val() - _minVal;
+            if (!s.allowed(vars[t], v))
+                continue;
+            if (s.valIndex[v] < 0) {
+                if ((int) s.indexedVals.size() == maxExactValues) {
+                    small = false;
+                    break;
+                }
+                s.valIndex[v] = s.indexedVals.size();
+                s.indexedVals.push_back(v);
+            }
+            s.domMask[t] |= 1u << s.valIndex[v];
+        }
+    }
+    bool counted = small && nbVars <= (int) s.indexedVals.size();
+    double total = 0;
+
+    int nbVals = s.indexedVals.size();
+    if (counted) {
+        /**
+         * counts[S] is the number of ways to assign the variables 0..t-1 to exactly the values in S, and backCounts[S]
+         * the number of ways to assign the variables t..nbVars-1 to values not in S, t being the size of S. layers[t]
+         * holds the subsets of size t the forward pass reaches. The solutions with the variable t assigned to the value
+         * v are the sum of counts[S] * backCounts[S + v] over layers[t], so one forward and one backward pass give the
+         * densities of all the variables.
+         */
+        s.layers.resize(nbVars + 1);
+        s.layers[0].assign(1, 0);
+        s.counts[0] = 1;
+        for (int t = 0; t < nbVars; t++) {
+            auto &next = s.layers[t + 1];
+            next.clear();
+            for (unsigned int mask : s.layers[t]) {
+                double count = s.counts[mask];
+                for (unsigned int bits = s.domMask[t] & ~mask; bits != 0; bits &= bits - 1) {
+                    unsigned int larger = mask | (bits & -bits);
+                    if (s.counts[larger] == 0)
+                        next.push_back(larger);
+                    s.counts[larger] += count;
+                }
+            }
+        }
+
+        s.valCount.assign((size_t)nbVars * nbVals, 0);
+        for (unsigned int mask : s.layers[nbVars])
+            s.backCounts[mask] = 1;
+        for (int t = nbVars - 1; t >= 0; t--) {
+            double *valCount = &s.valCount[(size_t)t * nbVals];
+            for (unsigned int mask : s.layers[t]) {
+                double count = s.counts[mask];
+                double back = 0;
+                for (unsigned int bits = s.domMask[t] & ~mask; bits != 0; bits &= bits - 1) {
+                    double ways = s.backCounts[mask | (bits & -bits)];
+                    back += ways;
+                    valCount[__builtin_ctz(bits)] += count * ways;
+                }
+                s.backCounts[mask] = back;
+            }
+        }
+        total = s.backCounts[0];
 
+        for (int t = 0; t <= nbVars; t++)
+            for (unsigned int mask : s.layers[t])
+                s.counts[mask] = s.backCounts[mask] = 0;
+        counted = total > 0;
+    }
 
-AllDiffCBS::LiangBaiFactors::LiangBaiFactors(int nbVar, int largestDomainSize)
-        : nbVar(nbVar), largestDomainSize(largestDomainSize) {
-    assert(!computed);
-    liangBaiFactors = heap.alloc<double *>(nbVar);
-    for (int i = 0; i < nbVar; i++)
-        liangBaiFactors[i] = heap.alloc<double>(largestDomainSize);
+    for (int k = 0; k < nbVars && counted; k++) {
+        const double *valCount = &s.valCount[(size_t)k * nbVals];
+        DensityScratch::VarDensities d{-1, 0, 2, 0};
+        for (IntVarValues val((IntVar)_x[vars[k]]); val(); ++val) {
+            int v = val.val() - _minVal;
+            double density = s.allowed(vars[k], v) ? valCount[s.valIndex[v]] / total : 0;
+            if (density > d.maxDensity)
+                d.maxDensity = density, d.maxVal = val.val();
+            if (density < d.minDensity)
+                d.minDensity = density, d.minVal = val.val();
+            if (s.table != nullptr)
+                s.table->push_back({vars[k], val.val(), density});
+        }
+        s.varDensities[vars[k]] = d;
+    }
 
-    precomputeLiangBaiFactors();
+    for (int v : s.indexedVals)
+        s.valIndex[v] = -1;
+    if (counted)
+        // Every variable gets the same total, the number of solutions of the component
+        s.exactLogCount += std::log(total);
+    return counted;
 }
 
-AllDiffCBS::LiangBaiFactors::~LiangBaiFactors() {
-    if (computed) {
-        for (int i = 0; i < nbVar; i++) {
-            heap.free(liangBaiFactors[i], largestDomainSize);
-        }
-        heap.free(liangBaiFactors, nbVar);
+void AllDiffCBS::precomputeDataStruct(int, int) {
+    // The factors are indexed by the variables and domain sizes of this constraint only, whatever the largest sizes
+    // over all the constraints of the brancher are.
+    if (_x.size() <= staticSize && _nbVal <= staticSize) {
+        _factors = &Factors::compileTime();
+    } else {
+        _runtimeFactors = FactorsHandle(new Factors(_x.size(), _nbVal));
+        _factors = &*_runtimeFactors;
     }
 }
 
-double AllDiffCBS::LiangBaiFactors::get(int index, int domSize) {
-    assert(index < nbVar);
-    assert(domSize <= largestDomainSize);
-    return liangBaiFactors[index][domSize - 1];
+void AllDiffCBS::dispose(Space &) {
+    _runtimeFactors.~FactorsHandle();
 }
 
-void AllDiffCBS::LiangBaiFactors::precomputeLiangBaiFactors() {
-    for (int i = 1; i <= nbVar; i++) {
-        double b = std::ceil(i / 2.0);
-        for (int j = 1; j <= largestDomainSize; j++) {
-            double a = std::ceil((j + 1) / 2.0);
-            double q = std::min(a, b);
-            liangBaiFactors[i - 1][j - 1] = q * (j - q + 1);
-        }
+void AllDiffCBS::updateDomains() {
+    for (int i = 0; i < _x.size(); i++)
+        if (domainChanged(_domSize, i))
+            updateSupports(i);
+}
+
+void AllDiffCBS::updateSupports(int var) {
+    const int word = var / bitsPerWord;
+    const Word mask = ~(Word(1) << (var % bitsPerWord));
+    // Clear the bit of var for every value in the holes between the ranges of its domain
+    int v = _minVal;
+    for (Int::ViewRanges<Int::IntView> r(_x[var]); r(); ++r) {
+        for (; v < r.min(); v++)
+            _valToVar[(v - _minVal) * _nbWords + word] &= mask;
+        v = r.max() + 1;
     }
+    for (; v < _minVal + _nbVal; v++)
+        _valToVar[(v - _minVal) * _nbWords + word] &= mask;
 }
 
 
+/***********************************************************************************************************************
+ * Factors
+ **********************************************************************************************************************/
+
+const AllDiffCBS::Factors &AllDiffCBS::Factors::compileTime() {
+    static const Factors table(staticSize, staticSize, staticFactors.minc, staticFactors.liangBai);
+    return table;
+}
+
+AllDiffCBS::Factors::Factors(int nbVar, int largestDomainSize, const double *minc, const double *liangBai)
+        : _nbVar(nbVar), _largestDomainSize(largestDomainSize), _minc(minc), _liangBai(liangBai) {}
+
+AllDiffCBS::Factors::Factors(int nbVar, int largestDomainSize)
+        : _nbVar(nbVar), _largestDomainSize(largestDomainSize),
+          _storage(largestDomainSize + (size_t)(nbVar + 1) / 2 * largestDomainSize) {
+    // Same computation as the compile-time tables, so both give exactly the same factors
+    std::vector<double> logs(largestDomainSize);
+    fillLogs(logs.data(), largestDomainSize);
+    fillMincFactors(_storage.data(), logs.data(), largestDomainSize);
+    fillLiangBaiFactors(_storage.data() + largestDomainSize, logs.data(), (nbVar + 1) / 2, largestDomainSize);
+    _minc = _storage.data();
+    _liangBai = _storage.data() + largestDomainSize;
+}
@@ -23,6 +23,7 @@
 #define CBS_ALLDIFFCBS_H
 
 #include <complex>
+#include <vector>
 #include "CBSConstraint.hpp"
 
 /**
@@ -34,67 +35,183 @@
  */
 class AllDiffCBS : public CBSConstraint/*<View, Val>*/ {
 public:
-    AllDiffCBS(Space &home, const IntVarArgs &x);
+    /**
+     * When at most exactThreshold variables are unassigned (and their domains span at most maxExactValues values),
+     * densities are computed from the exact number of solutions instead of the upper bounds.
+     */
+    AllDiffCBS(Space &home, const IntVarArgs &x, int exactThreshold = 8);
 
     AllDiffCBS(Space &home, bool share, AllDiffCBS *c);
 
     CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
 
-    CBSPosValDensity getDensity(std::function<bool(double,double)> comparator) const override;
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
 
     void precomputeDataStruct(int nbVar, int largestDomainSize) override;
 
+    void dispose(Space &home) override;
+
 private:
+    // Bring _domSize and _valToVar up to date, only looking at the variables whose domain changed.
+    void updateDomains();
+
+    // Clear the bits of _valToVar for the values that are no longer in the domain of var.
+    void updateSupports(int var);
+
     /**
-     * Factors precomputed for every value in the domain of x. Thoses factors are used to compute the Minc and Brégman
-     * upper bound for the permanent.
+     * Remove from the domains of the unassigned variables the values held by assigned variables, and the values of
+     * the saturated Hall intervals of the other variables. Returns false if there is no solution.
      */
-    class MincFactors {
-    public:
-        MincFactors();
+    bool restrictDomains(int nbUnassigned) const;
+
+    // Densities of 0 for all the unassigned variables, when there is no solution
+    void noDensity() const;
+
+    /**
+     * Group the unassigned variables in connected components of the value graph (variables sharing a value they can
+     * take, see restrictDomains()) and return their number. The components are left in the scratch memory of
+     * getDensity().
+     */
+    int findComponents() const;
 
-        MincFactors(int largestDomainSize);
+    /**
+     * Common part of getDensity() and getDensities(): exact densities of the small components, and what the upper
+     * bounds need for the other variables. Sets nbUnassigned and returns whether all the densities are exact.
+     */
+    bool prepareDensities(int &nbUnassigned);
 
-        ~MincFactors();
+    // Memory of getDensity(), see AllDiffCBS.cpp
+    struct DensityScratch;
 
-        double get(int domSize);
+    /**
+     * Best choice for the comparator Density, once the exact densities are known. The densities of the other variables
+     * are computed from the upper bounds when bounds is true, in chunks on the thread pool for large constraints.
+     */
+    template<class Density>
+    CBSPosValDensity selectDensity(bool bounds, int nbUnassigned) const;
 
-    private:
-        // Recursive function for precomputing mincFactors from 1..n
-        double precomputeMincFactors(int n);
+    // Best choice among the unassigned variables begin..end-1 (pos is -1 when there are none)
+    template<class Density>
+    CBSPosValDensity bestDensity(const DensityScratch &s, int begin, int end) const;
 
-    private:
-        double *mincFactors;
-        int largestDomainSize;
-    };
+    /**
+     * Upper bounds of the components without exact densities, and their change when a value is removed from a
+     * variable, and from all the variables supporting it.
+     */
+    void boundFactors(int nbComponents) const;
+
+    // Densities of the variables begin..end-1 without exact densities, from the upper bounds.
+    void boundDensity(DensityScratch &s, int begin, int end) const;
+
+    /**
+     * Densities of the variables vars from the exact number of solutions, counted by dynamic programming over the
+     * subsets of values they use. The variables must form components of the value graph. Returns false when there
+     * are too many of them (see _exactThreshold) or no solution.
+     */
+    bool exactDensity(const int *vars, int nbVars) const;
+
+private:
+    typedef unsigned long long Word;
+    static const int bitsPerWord = 64;
+
+    /**
+     * Domain size of every variable the last time _valToVar was updated. Like the rest of the constraint, it is copied
+     * with the space, so a child node starts from the incidence of its parent instead of rebuilding it.
+     */
+    int *_domSize;
+
+    // Smallest value and number of values spanned by the domains of the variables when the constraint was posted
+    int _minVal;
+    int _nbVal;
+    /**
+     * Value to variables incidence matrix. For a given value, we need to know which variables can be assigned to it.
+     * Row v - _minVal holds _nbWords words whose bit i is set when v is in the domain of _x[i]. It is updated for the
+     * variables whose domain changed.
+     */
+    Word *_valToVar;
+    int _nbWords;
+
+    // Largest number of unassigned variables for which exact densities are computed
+    int _exactThreshold;
+    /**
+     * Largest number of values in the domains of the unassigned variables for which exact densities are computed. The
+     * counts grow with the subsets of the values: up to 8 values, they cost less than twice the upper bounds for 3 to
+     * 8 variables, and more than 4 times beyond 12 values.
+     */
+    static const int maxExactValues = 8;
+
+    // Largest number of unassigned variables for which saturated Hall intervals are searched
+    static const int maxHallVariables = 1024;
+
+    // Smallest number of unassigned variables for which densities are computed in parallel, in chunks of variables
+    static const int parallelThreshold = 2048;
+    static const int parallelChunk = 256;
 
     /**
-     * Factors precomputed for every index and domain size in x. Thoses factors are used to compute the Liang and Bai
-     * upper bound for the permanent
+     * Factors used to compute the upper bounds on the permanent, stored as logarithms so the bounds can be computed
+     * with sums for constraints with hundreds of variables:
+     *  - Minc and Brégman factors for every domain size,
+     *  - Liang and Bai factors for every index and domain size.
+     *
+     * The tables for up to 128 variables and values are generated at compile time and shared by all the constraints.
+     * Larger tables are computed at runtime and owned by the constraint through a FactorsHandle, so they are freed
+     * with its last copy. A table never changes once built.
      */
-    class LiangBaiFactors {
+    class Factors : public SharedHandle::Object {
     public:
-        LiangBaiFactors();
+        // Tables computed at compile time, for up to 128 variables and values
+        static const Factors &compileTime();
+
+        // Tables computed at runtime
+        Factors(int nbVar, int largestDomainSize);
 
-        LiangBaiFactors(int nbVar, int largestDomainSize);
+        // Computed again rather than copied, as the tables point into their own storage
+        SharedHandle::Object *copy() const override {
+            return new Factors(_nbVar, _largestDomainSize);
+        }
 
-        ~LiangBaiFactors();
+        double minc(int domSize) const {
+            assert(domSize >= 1 && domSize <= _largestDomainSize);
+            return _minc[domSize - 1];
+        }
 
-        double get(int index, int domSize);
+        double liangBai(int index, int domSize) const {
+            assert(index < _nbVar);
+            assert(domSize >= 1 && domSize <= _largestDomainSize);
+            return _liangBai[index / 2 * _largestDomainSize + domSize - 1];
+        }
 
     private:
-        void precomputeLiangBaiFactors();
+        // Tables over memory that is already filled, used for the compile-time tables
+        Factors(int nbVar, int largestDomainSize, const double *minc, const double *liangBai);
 
     private:
-        double **liangBaiFactors;
-        int nbVar;
-        int largestDomainSize;
+        int _nbVar;
+        int _largestDomainSize;
+        const double *_minc;
+        // Row index / 2 holds the factors of the variable at index for all the domain sizes
+        const double *_liangBai;
+        // Memory of the tables computed at runtime
+        std::vector<double> _storage;
     };
 
-private:
-    static bool computed;
-    static MincFactors mincFactors;
-    static LiangBaiFactors liangBaiFactors;
+    class FactorsHandle : public SharedHandle {
+    public:
+        FactorsHandle() {}
+
+        explicit FactorsHandle(Factors *f) : SharedHandle(f) {}
+
+        const Factors &operator*() const {
+            return *static_cast<const Factors *>(object());
+        }
+    };
+
+    // Set in precomputeDataStruct(), either the compile-time tables or the ones of _runtimeFactors
+    const Factors *_factors;
+    // Runtime tables of this constraint and its copies, empty when the compile-time tables are large enough
+    FactorsHandle _runtimeFactors;
 };
 
 #endif //CBS_ALLDIFFCBS_H
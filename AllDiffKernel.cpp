@@ -0,0 +1,268 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "AllDiffKernel.h"
+
+#include <algorithm>
+
+// Vectorized versions are only compiled for x86 with a compiler that can target an instruction set per function.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CBS_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace AllDiffKernel {
+
+    typedef Result (*Kernel)(const double *, const double *, const int *, int, double, double, double *);
+
+    /*******************************************************************************************************************
+     * Scalar version
+     ******************************************************************************************************************/
+
+    // Process the values from index k to n-1, updating r which holds the extremes of the values before k.
+    static inline void boundsTail(const double *valMinc, const double *valLiangBai, const int *vals, int k, int n,
+                                  double mincShift, double liangBaiShift, double *bounds, Result &r) {
+        for (; k < n; k++) {
+            double b = std::min(mincShift + valMinc[vals[k]], liangBaiShift + valLiangBai[vals[k]]);
+            bounds[k] = b;
+            if (b > r.maxBound) {
+                r.maxBound = b;
+                r.argMax = k;
+            }
+            if (b < r.minBound) {
+                r.minBound = b;
+                r.argMin = k;
+            }
+        }
+    }
+
+    static Result boundsScalar(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                               double mincShift, double liangBaiShift, double *bounds) {
+        bounds[0] = std::min(mincShift + valMinc[vals[0]], liangBaiShift + valLiangBai[vals[0]]);
+        Result r{bounds[0], 0, bounds[0], 0};
+        boundsTail(valMinc, valLiangBai, vals, 1, n, mincShift, liangBaiShift, bounds, r);
+        return r;
+    }
+
+#ifdef CBS_KERNEL_X86
+    /*******************************************************************************************************************
+     * Vectorized versions
+     *
+     * Each lane keeps the extremes of the indices congruent to it, along with their index (stored as a double so it
+     * can be blended like the bounds). Strict comparisons keep the first index of a lane, and the lanes are reduced
+     * by taking the smallest index among equal extremes, so the result is the same as the scalar version.
+     ******************************************************************************************************************/
+
+    // Reduce the extremes of the lanes into a result
+    static inline Result reduceLanes(const double *maxV, const double *maxI, const double *minV, const double *minI,
+                                     int lanes) {
+        Result r{maxV[0], (int) maxI[0], minV[0], (int) minI[0]};
+        for (int l = 1; l < lanes; l++) {
+            if (maxV[l] > r.maxBound || (maxV[l] == r.maxBound && maxI[l] < r.argMax)) {
+                r.maxBound = maxV[l];
+                r.argMax = (int) maxI[l];
+            }
+            if (minV[l] < r.minBound || (minV[l] == r.minBound && minI[l] < r.argMin)) {
+                r.minBound = minV[l];
+                r.argMin = (int) minI[l];
+            }
+        }
+        return r;
+    }
+
+    // Bounds of the values at index k and k+1
+    __attribute__((target("sse4.2")))
+    static inline __m128d boundSSE(const double *valMinc, const double *valLiangBai, const int *vals, int k,
+                                   __m128d ms, __m128d ls) {
+        // No gather instruction before AVX2
+        __m128d m = _mm_set_pd(valMinc[vals[k + 1]], valMinc[vals[k]]);
+        __m128d l = _mm_set_pd(valLiangBai[vals[k + 1]], valLiangBai[vals[k]]);
+        return _mm_min_pd(_mm_add_pd(ms, m), _mm_add_pd(ls, l));
+    }
+
+    __attribute__((target("sse4.2")))
+    static Result boundsSSE(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                            double mincShift, double liangBaiShift, double *bounds) {
+        const int lanes = 2;
+        if (n < lanes)
+            return boundsScalar(valMinc, valLiangBai, vals, n, mincShift, liangBaiShift, bounds);
+
+        const __m128d ms = _mm_set1_pd(mincShift), ls = _mm_set1_pd(liangBaiShift), step = _mm_set1_pd(lanes);
+        __m128d idx = _mm_set_pd(1, 0);
+        __m128d b = boundSSE(valMinc, valLiangBai, vals, 0, ms, ls);
+        _mm_storeu_pd(bounds, b);
+        __m128d maxV = b, maxI = idx, minV = b, minI = idx;
+        int k = lanes;
+        for (; k + lanes <= n; k += lanes) {
+            idx = _mm_add_pd(idx, step);
+            b = boundSSE(valMinc, valLiangBai, vals, k, ms, ls);
+            _mm_storeu_pd(bounds + k, b);
+            __m128d gt = _mm_cmpgt_pd(b, maxV);
+            maxV = _mm_blendv_pd(maxV, b, gt);
+            maxI = _mm_blendv_pd(maxI, idx, gt);
+            __m128d lt = _mm_cmplt_pd(b, minV);
+            minV = _mm_blendv_pd(minV, b, lt);
+            minI = _mm_blendv_pd(minI, idx, lt);
+        }
+
+        double lanesMaxV[lanes], lanesMaxI[lanes], lanesMinV[lanes], lanesMinI[lanes];
+        _mm_storeu_pd(lanesMaxV, maxV);
+        _mm_storeu_pd(lanesMaxI, maxI);
+        _mm_storeu_pd(lanesMinV, minV);
+        _mm_storeu_pd(lanesMinI, minI);
+        Result r = reduceLanes(lanesMaxV, lanesMaxI, lanesMinV, lanesMinI, lanes);
+        boundsTail(valMinc, valLiangBai, vals, k, n, mincShift, liangBaiShift, bounds, r);
+        return r;
+    }
+
+    // Bounds of the values at index k to k+3
+    __attribute__((target("avx2")))
+    static inline __m256d boundAVX2(const double *valMinc, const double *valLiangBai, const int *vals, int k,
+                                    __m256d ms, __m256d ls) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(vals + k));
+        __m256d m = _mm256_i32gather_pd(valMinc, v, sizeof(double));
+        __m256d l = _mm256_i32gather_pd(valLiangBai, v, sizeof(double));
+        return _mm256_min_pd(_mm256_add_pd(ms, m), _mm256_add_pd(ls, l));
+    }
+
+    __attribute__((target("avx2")))
+    static Result boundsAVX2(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                             double mincShift, double liangBaiShift, double *bounds) {
+        const int lanes = 4;
+        if (n < lanes)
+            return boundsScalar(valMinc, valLiangBai, vals, n, mincShift, liangBaiShift, bounds);
+
+        const __m256d ms = _mm256_set1_pd(mincShift), ls = _mm256_set1_pd(liangBaiShift);
+        const __m256d step = _mm256_set1_pd(lanes);
+        __m256d idx = _mm256_set_pd(3, 2, 1, 0);
+        __m256d b = boundAVX2(valMinc, valLiangBai, vals, 0, ms, ls);
+        _mm256_storeu_pd(bounds, b);
+        __m256d maxV = b, maxI = idx, minV = b, minI = idx;
+        int k = lanes;
+        for (; k + lanes <= n; k += lanes) {
+            idx = _mm256_add_pd(idx, step);
+            b = boundAVX2(valMinc, valLiangBai, vals, k, ms, ls);
+            _mm256_storeu_pd(bounds + k, b);
+            __m256d gt = _mm256_cmp_pd(b, maxV, _CMP_GT_OQ);
+            maxV = _mm256_blendv_pd(maxV, b, gt);
+            maxI = _mm256_blendv_pd(maxI, idx, gt);
+            __m256d lt = _mm256_cmp_pd(b, minV, _CMP_LT_OQ);
+            minV = _mm256_blendv_pd(minV, b, lt);
+            minI = _mm256_blendv_pd(minI, idx, lt);
+        }
+
+        double lanesMaxV[lanes], lanesMaxI[lanes], lanesMinV[lanes], lanesMinI[lanes];
+        _mm256_storeu_pd(lanesMaxV, maxV);
+        _mm256_storeu_pd(lanesMaxI, maxI);
+        _mm256_storeu_pd(lanesMinV, minV);
+        _mm256_storeu_pd(lanesMinI, minI);
+        Result r = reduceLanes(lanesMaxV, lanesMaxI, lanesMinV, lanesMinI, lanes);
+        boundsTail(valMinc, valLiangBai, vals, k, n, mincShift, liangBaiShift, bounds, r);
+        return r;
+    }
+
+    // Bounds of the values at index k to k+7
+    __attribute__((target("avx512f")))
+    static inline __m512d boundAVX512(const double *valMinc, const double *valLiangBai, const int *vals, int k,
+                                      __m512d ms, __m512d ls) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vals + k));
+        __m512d m = _mm512_i32gather_pd(v, valMinc, sizeof(double));
+        __m512d l = _mm512_i32gather_pd(v, valLiangBai, sizeof(double));
+        return _mm512_min_pd(_mm512_add_pd(ms, m), _mm512_add_pd(ls, l));
+    }
+
+    __attribute__((target("avx512f")))
+    static Result boundsAVX512(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                               double mincShift, double liangBaiShift, double *bounds) {
+        const int lanes = 8;
+        if (n < lanes)
+            return boundsAVX2(valMinc, valLiangBai, vals, n, mincShift, liangBaiShift, bounds);
+
+        const __m512d ms = _mm512_set1_pd(mincShift), ls = _mm512_set1_pd(liangBaiShift);
+        const __m512d step = _mm512_set1_pd(lanes);
+        __m512d idx = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+        __m512d b = boundAVX512(valMinc, valLiangBai, vals, 0, ms, ls);
+        _mm512_storeu_pd(bounds, b);
+        __m512d maxV = b, maxI = idx, minV = b, minI = idx;
+        int k = lanes;
+        for (; k + lanes <= n; k += lanes) {
+            idx = _mm512_add_pd(idx, step);
+            b = boundAVX512(valMinc, valLiangBai, vals, k, ms, ls);
+            _mm512_storeu_pd(bounds + k, b);
+            __mmask8 gt = _mm512_cmp_pd_mask(b, maxV, _CMP_GT_OQ);
+            maxV = _mm512_mask_blend_pd(gt, maxV, b);
+            maxI = _mm512_mask_blend_pd(gt, maxI, idx);
+            __mmask8 lt = _mm512_cmp_pd_mask(b, minV, _CMP_LT_OQ);
+            minV = _mm512_mask_blend_pd(lt, minV, b);
+            minI = _mm512_mask_blend_pd(lt, minI, idx);
+        }
+
+        double lanesMaxV[lanes], lanesMaxI[lanes], lanesMinV[lanes], lanesMinI[lanes];
+        _mm512_storeu_pd(lanesMaxV, maxV);
+        _mm512_storeu_pd(lanesMaxI, maxI);
+        _mm512_storeu_pd(lanesMinV, minV);
+        _mm512_storeu_pd(lanesMinI, minI);
+        Result r = reduceLanes(lanesMaxV, lanesMaxI, lanesMinV, lanesMinI, lanes);
+        boundsTail(valMinc, valLiangBai, vals, k, n, mincShift, liangBaiShift, bounds, r);
+        return r;
+    }
+#endif
+
+    /*******************************************************************************************************************
+     * Runtime dispatch
+     ******************************************************************************************************************/
+
+    struct Dispatch {
+        Kernel kernel;
+        const char *name;
+
+        Dispatch() : kernel(boundsScalar), name("scalar") {
+#ifdef CBS_KERNEL_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                kernel = boundsAVX512;
+                name = "avx512f";
+            } else if (__builtin_cpu_supports("avx2")) {
+                kernel = boundsAVX2;
+                name = "avx2";
+            } else if (__builtin_cpu_supports("sse4.2")) {
+                kernel = boundsSSE;
+                name = "sse4.2";
+            }
+#endif
+        }
+    };
+
+    // Initialized once, the first time the kernel is used (thread-safe since C++11)
+    static const Dispatch &dispatch() {
+        static const Dispatch d;
+        return d;
+    }
+
+    Result bounds(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                  double mincShift, double liangBaiShift, double *bounds) {
+        return dispatch().kernel(valMinc, valLiangBai, vals, n, mincShift, liangBaiShift, bounds);
+    }
+
+    const char *isa() {
+        return dispatch().name;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_ALLDIFFKERNEL_H
+#define CBS_ALLDIFFKERNEL_H
+
+/**
+ * Density kernel of AllDiffCBS.
+ *
+ * For a variable x_i, the log upper bound of the permanent once x_i is assigned to the value v is
+ *
+ *     min(mincShift + valMinc[v], liangBaiShift + valLiangBai[v])
+ *
+ * where valMinc and valLiangBai only depend on the value and the shifts only on the variable. The kernel computes
+ * this bound for all the values of the domain of x_i, packed in vals, along with the largest and the smallest bound.
+ * The instruction set (AVX-512, AVX2, SSE4.2 or plain scalar code) is picked once at runtime from what the processor
+ * supports. All of them give exactly the same results.
+ */
+namespace AllDiffKernel {
+    struct Result {
+        // Largest bound and the first index where it is found
+        double maxBound;
+        int argMax;
+        // Smallest bound and the first index where it is found
+        double minBound;
+        int argMin;
+    };
+
+    // Write the n bounds in bounds, n must be at least 1.
+    Result bounds(const double *valMinc, const double *valLiangBai, const int *vals, int n,
+                  double mincShift, double liangBaiShift, double *bounds);
+
+    // Name of the instruction set used by bounds()
+    const char *isa();
+}
+
+#endif //CBS_ALLDIFFKERNEL_H
@@ -21,24 +21,50 @@
  */
 #include "CBSBrancher.h"
 
+#include "CBSNaryChoice.hpp"
 #include "CBSPosValChoice.hpp"
+#include "CBSThreadPool.h"
 
-#include <functional>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+    // Memory of CBSBrancher::aggregatedChoice(), kept between the calls of a search thread to avoid allocations.
+    struct AggregationScratch {
+        // Unassigned constraints, the densities of all their values and the logarithm of their number of solutions
+        std::vector<int> pending;
+        std::vector<std::vector<CBSPosValDensity>> tables;
+        std::vector<double> logCounts;
+
+        // For every variable of the brancher: first constraint and position where it is found (-1 if it is not in
+        // this choice), start of its values in score and its smallest value, largest number of solutions of its
+        // constraints, last constraint seen, weight of that constraint and total weight of its constraints
+        std::vector<int> firstCons, firstPos, start, minVal, lastCons;
+        std::vector<double> maxLogCount, consWeight, weight;
+
+        // Score of every (variable, value) pair, and of the values of the chosen variable for an n-ary choice
+        std::vector<double> score;
+        std::vector<CBSPosValDensity> values;
+    };
+    thread_local AggregationScratch aggregation;
+}
 
 /***********************************************************************************************************************
  * CBSBrancher
  **********************************************************************************************************************/
 
-CBSBrancher::CBSBrancher(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy)
-        : _constraints(constraints.begin(), constraints.end(), CBSConstraintVector::allocator_type(home)),
-          _strategy(strategy), Brancher(home) {
+CBSBrancher::CBSBrancher(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy,
+                         const CBSOptions &options)
+        : Brancher(home),
+          _constraints(constraints.begin(), constraints.end(), CBSConstraintVector::allocator_type(home)),
+          _strategy(strategy), _options(options), _start(0), _rnd(options.seed) {
     /**
      * Some constraints share precomputed data structures. For this reason, each constraint must gives information about
      * the domain of its variables so the precomputed data structures are usable for all constraints.
      *
-     * As an exemple, we can consider the all different constraint. This constraint needs a precomputed array that spans
-     * from 1 to n (n being the domain size of the variable with the largest domain in the constraint). If we want to
-     * share this structure, we must take into account all counstraints.
+     * A constraint may also size its structures from its own variables only, as the all different constraint does
+     * for its factor tables: a single large domain in another constraint, such as an objective, would make them huge.
      */
     int largestDomainSize = 0;
     int highestNumberOfVars = 0;
@@ -48,18 +74,53 @@ CBSBrancher::CBSBrancher(Space &home, std::vector<CBSConstraint*> &constraints,
         highestNumberOfVars = std::max(highestNumberOfVars, c->size());
     }
 
-    for (auto& c : _constraints)
+    for (auto& c : _constraints) {
         c->precomputeDataStruct(highestNumberOfVars, largestDomainSize);
+        c->threads(_options.threads);
+    }
+
+    // The constraints and _rnd may hold shared handles, released in dispose() even if the space is deleted first.
+    home.notice(*this, AP_DISPOSE);
+
+    // The aggregated strategies combine the densities of the views of the same variable in different constraints.
+    _varStart = _varIndex = nullptr;
+    _nbVars = 0;
+    if (_strategy != MIN_BRANCHING && _strategy != MAX_BRANCHING) {
+        _varStart = home.alloc<int>(_constraints.size() + 1);
+        _varStart[0] = 0;
+        for (int c = 0; c < (int) _constraints.size(); c++)
+            _varStart[c + 1] = _varStart[c] + _constraints[c]->size();
+        _varIndex = home.alloc<int>(_varStart[_constraints.size()]);
+
+        std::unordered_map<const void*, int> index;
+        for (int c = 0; c < (int) _constraints.size(); c++) {
+            for (int pos = 0; pos < _constraints[c]->size(); pos++) {
+                auto v = index.insert({_constraints[c]->view(pos).varimp(), _nbVars});
+                if (v.second)
+                    _nbVars++;
+                _varIndex[_varStart[c] + pos] = v.first->second;
+            }
+        }
+    }
 }
 
-void CBSBrancher::post(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy) {
-//                       std::function<bool(double,double)> densityComparator) {
-    (void) new(home) CBSBrancher(home, constraints, strategy);
+void CBSBrancher::post(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy,
+                       const CBSOptions &options) {
+    (void) new(home) CBSBrancher(home, constraints, strategy, options);
 }
 
 CBSBrancher::CBSBrancher(Space &home, bool share, CBSBrancher &b)
-        : _constraints(CBSConstraintVector::allocator_type(home)),
-            _strategy(b._strategy), Brancher(home, share, b) {
+        : Brancher(home, share, b), _constraints(CBSConstraintVector::allocator_type(home)),
+          _strategy(b._strategy), _options(b._options), _varStart(nullptr), _varIndex(nullptr),
+          _nbVars(b._nbVars), _start(b._start) {
+    _rnd.update(home, share, b._rnd);
+    if (b._varStart != nullptr) {
+        _varStart = home.alloc<int>(b._constraints.size() + 1);
+        std::copy(b._varStart, b._varStart + b._constraints.size() + 1, _varStart);
+        _varIndex = home.alloc<int>(_varStart[b._constraints.size()]);
+        std::copy(b._varIndex, b._varIndex + _varStart[b._constraints.size()], _varIndex);
+    }
+
     // We copy all constraints
     _constraints.reserve(b._constraints.size());
     for (auto& c : b._constraints)
@@ -70,70 +131,386 @@ Brancher *CBSBrancher::copy(Space &home, bool share) {
     return new(home) CBSBrancher(home, share, *this);
 }
 
+size_t CBSBrancher::dispose(Space &home) {
+    home.ignore(*this, AP_DISPOSE);
+    for (auto& c : _constraints)
+        c->dispose(home);
+    _rnd.~Rnd();
+    (void) Brancher::dispose(home);
+    return sizeof(*this);
+}
+
 bool CBSBrancher::status(const Space &home) const {
-    // To check if there's still work to do, we must ask each constraint if there are unassigned variables.
-    for (auto const &c : _constraints)
-        if (!c->allAssigned())
+    // To check if there's still work to do, we must ask each constraint if there are unassigned variables. Variables
+    // stay assigned below this node, so the constraints found with all their variables assigned are skipped next time.
+    for (; _start < (int) _constraints.size(); _start++)
+        if (!_constraints[_start]->allAssigned())
             return true;
     return false;
 }
 
+template<class Density>
+const Choice *CBSBrancher::bestChoice() {
+    // Kept between the calls of a search thread. Thread locals are named from the thread running the code, so the
+    // tasks use them through references.
+    thread_local std::vector<Candidate> candidatesMemory;
+    thread_local std::vector<int> pendingMemory;
+    std::vector<Candidate> &candidates = candidatesMemory;
+    std::vector<int> &pending = pendingMemory;
+
+    /**
+     * The constraints are evaluated from the one with the smallest domain, the most likely to hold a forced value,
+     * and nothing is better than a forced value (or a 0 density for the lowest density). Constraints untouched since
+     * their last choice give it for free. The order only depends on the domains, so the choice does not depend on
+     * which constraints were evaluated before, nor on the number of threads. With randomTies, every constraint that
+     * may tie the best density is evaluated, so randomTie() knows which ones hold a tie.
+     */
+    bool ties = _options.randomTies;
+    candidates.clear();
+    for (int i = _start; i < (int) _constraints.size(); i++) {
+        if (_constraints[i]->allAssigned())
+            continue;
+        Candidate c;
+        c.cIdx = i;
+        c.known = _constraints[i]->lastDensity(_strategy, c.choice, c.minSize);
+        candidates.push_back(c);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.minSize < b.minSize || (a.minSize == b.minSize && a.cIdx < b.cIdx);
+    });
+
+    if (_options.threads > 1) {
+        // Every task evaluates its own constraint, nothing else is written. There is no need to evaluate the ones
+        // after a known forced value.
+        pending.clear();
+        for (int k = 0; k < (int) candidates.size(); k++) {
+            if (!ties && candidates[k].known && candidates[k].choice.density == Density::best())
+                break;
+            if (!candidates[k].known)
+                pending.push_back(k);
+        }
+        CBSThreadPool::pool().run(pending.size(), _options.threads, [&](int k) {
+            Candidate &c = candidates[pending[k]];
+            c.choice = _constraints[c.cIdx]->cachedDensity(_strategy);
+            c.known = true;
+        });
+    }
+
+    int cIdx = -1;
+    CBSPosValDensity choice;
+    for (auto &c : candidates) {
+        if (!ties && cIdx >= 0 && choice.density == Density::best())
+            break;
+        if (!c.known) {
+            // Evaluate the constraint only if its bound can beat (or tie) the current choice
+            if (cIdx >= 0) {
+                double bound = _constraints[c.cIdx]->densityBound(_strategy);
+                if (!Density::better(bound, choice.density) && !(ties && tie(bound, choice.density)))
+                    continue;
+            }
+            c.choice = _constraints[c.cIdx]->cachedDensity(_strategy);
+            c.known = true;
+        }
+        // If this choice is better than the current one...
+        if (cIdx < 0 || Density::better(c.choice.density, choice.density)) {
+            cIdx = c.cIdx;
+            choice = c.choice;
+        }
+    }
+    assert(cIdx >= 0);
+    if (ties)
+        randomTie(candidates, cIdx, choice);
+    if (_options.nary)
+        return naryChoice<Density>(cIdx, choice.pos);
+    if (_options.temperature > 0) {
+        thread_local std::vector<CBSPosValDensity> values;
+        variableDensities(cIdx, choice.pos, values);
+        choice = softmaxValue(values, _strategy == MIN_BRANCHING);
+    }
+    // x != v is the other values of the variable, of density 1 - d
+    double gap = _strategy == MIN_BRANCHING ? 1 - 2 * choice.density : 2 * choice.density - 1;
+    return new CBSPosValChoice<int>(*this, 2, choice.pos, choice.val, cIdx, choice.density, gap);
+}
+
+void CBSBrancher::randomTie(const std::vector<Candidate> &candidates, int &cIdx, CBSPosValDensity &choice) {
+    thread_local std::vector<CBSPosValDensity> densities;
+    double best = choice.density;
+    unsigned int ties = 0;
+
+    /**
+     * Reservoir sampling over the pairs of the best density. A constraint whose best density does not tie the choice
+     * has no such pair, and the constraints left unevaluated by bestChoice() had a bound worse than the choice, so
+     * only the constraints whose best density ties the choice are evaluated entirely.
+     */
+    for (const auto &c : candidates) {
+        if (!c.known || !tie(c.choice.density, best))
+            continue;
+        densities.clear();
+        _constraints[c.cIdx]->getDensities(densities);
+        for (const auto &d : densities) {
+            if (tie(d.density, best) && _rnd(++ties) == 0) {
+                cIdx = c.cIdx;
+                choice = d;
+            }
+        }
+    }
+}
+
+CBSPosValDensity CBSBrancher::softmaxValue(const std::vector<CBSPosValDensity> &values, bool lowest) {
+    assert(!values.empty());
+    thread_local std::vector<double> weights;
+    double sign = lowest ? -1 : 1;
+
+    // Shifted by the best density, so the weights do not overflow
+    double best = -std::numeric_limits<double>::infinity();
+    for (const auto &v : values)
+        best = std::max(best, sign * v.density);
+    weights.clear();
+    double total = 0;
+    for (const auto &v : values) {
+        weights.push_back(std::exp((sign * v.density - best) / _options.temperature));
+        total += weights.back();
+    }
+
+    const unsigned int resolution = 1U << 30;
+    double r = total * _rnd(resolution) / resolution;
+    for (int k = 0; k < (int) values.size(); k++) {
+        r -= weights[k];
+        if (r < 0)
+            return values[k];
+    }
+    return values.back();
+}
+
+void CBSBrancher::variableDensities(int cIdx, int pos, std::vector<CBSPosValDensity> &values) {
+    thread_local std::vector<CBSPosValDensity> densities;
+    densities.clear();
+    _constraints[cIdx]->getDensities(densities);
+    values.clear();
+    for (const auto &d : densities)
+        if (d.pos == pos)
+            values.push_back(d);
+}
+
+template<class Density>
+const Choice *CBSBrancher::naryChoice(int cIdx, int pos) {
+    thread_local std::vector<CBSPosValDensity> values;
+    variableDensities(cIdx, pos, values);
+
+    // The values come in increasing order, and stay so among equal densities.
+    std::stable_sort(values.begin(), values.end(), [](const CBSPosValDensity &a, const CBSPosValDensity &b) {
+        return Density::better(a.density, b.density);
+    });
+    return naryChoice(cIdx, pos, values);
+}
+
+const Choice *CBSBrancher::naryChoice(int cIdx, int pos, const std::vector<CBSPosValDensity> &values) {
+    assert(!values.empty());
+    auto *c = new CBSNaryChoice(*this, values.size(), pos, cIdx);
+    for (int a = 0; a < (int) values.size(); a++)
+        c->set(a, values[a].val, values[a].density);
+    return c;
+}
+
 const Choice *CBSBrancher::choice(Space &home) {
     assert(status(home));
 
-    // TODO: TEMPORAIRE, trouver une meilleur facon de faire les choses ici.. Le problème c'est que je ne sais pas
-    // TODO: comment utiliser un allocateur pour un objet de type std::function<bool(double,double)>... Alors je ne suis pas
-    // TODO: capable de garder la fonction en référence dans ma classe sans avoir un leak..
-    std::function<bool(double,double)> densityComparator;
     switch (_strategy) {
         case MIN_BRANCHING:
-            densityComparator = std::less<double>();
-            break;
+            return bestChoice<CBSMinDensity>();
         case MAX_BRANCHING:
-            densityComparator = std::greater<double>();
-            break;
+            return bestChoice<CBSMaxDensity>();
         default:
-            assert(false);
+            return aggregatedChoice();
     }
+}
+
+const Choice *CBSBrancher::aggregatedChoice() {
+    const double infinity = std::numeric_limits<double>::infinity();
+    // Through a reference, as the tasks run on other threads, see bestChoice()
+    AggregationScratch &a = aggregation;
+
+    a.pending.clear();
+    for (int i = _start; i < (int) _constraints.size(); i++)
+        if (!_constraints[i]->allAssigned())
+            a.pending.push_back(i);
+    int n = a.pending.size();
+    assert(n > 0);
+    if ((int) a.tables.size() < n)
+        a.tables.resize(n);
+    a.logCounts.resize(n);
+
+    CBSThreadPool::pool().run(n, _options.threads, [&](int k) {
+        a.tables[k].clear();
+        a.logCounts[k] = _constraints[a.pending[k]]->getDensities(a.tables[k]);
+    });
 
-    int cIdx = 0;
-    // We search for a constraint whose variables are not all assigned
-    while (_constraints[cIdx]->allAssigned()) {
-        cIdx++;
-        assert(cIdx < _constraints.size());
+    // Variables of the choice: where their scores start, and the largest number of solutions of their constraints
+    a.firstCons.assign(_nbVars, -1);
+    a.firstPos.resize(_nbVars);
+    a.start.resize(_nbVars);
+    a.minVal.resize(_nbVars);
+    a.lastCons.assign(_nbVars, -1);
+    a.maxLogCount.assign(_nbVars, -infinity);
+    int nbScores = 0;
+    for (int k = 0; k < n; k++) {
+        int c = a.pending[k];
+        for (const auto &d : a.tables[k]) {
+            int var = _varIndex[_varStart[c] + d.pos];
+            if (a.firstCons[var] < 0) {
+                const auto &x = _constraints[c]->view(d.pos);
+                a.firstCons[var] = c;
+                a.firstPos[var] = d.pos;
+                a.start[var] = nbScores;
+                a.minVal[var] = x.min();
+                nbScores += x.max() - x.min() + 1;
+            }
+            if (a.lastCons[var] != k) {
+                a.lastCons[var] = k;
+                a.maxLogCount[var] = std::max(a.maxLogCount[var], a.logCounts[k]);
+            }
+        }
     }
 
-    // Choice for the first constraint found
-    auto choice = _constraints[cIdx]->getDensity(densityComparator);
+    // Score of every (variable, value) pair. The averages are divided by the total weight of the constraints of the
+    // variable at the end.
+    a.score.assign(nbScores, _strategy == MAXRELSD_BRANCHING ? -infinity : 0);
+    a.lastCons.assign(_nbVars, -1);
+    a.weight.assign(_nbVars, 0);
+    a.consWeight.resize(_nbVars);
+    for (int k = 0; k < n; k++) {
+        int c = a.pending[k];
+        for (const auto &d : a.tables[k]) {
+            int var = _varIndex[_varStart[c] + d.pos];
+            double &score = a.score[a.start[var] + d.val - a.minVal[var]];
+            if (_strategy == MAXRELSD_BRANCHING) {
+                score = std::max(score, d.density - 1.0 / _constraints[c]->view(d.pos).size());
+                continue;
+            }
+
+            if (a.lastCons[var] != k) {
+                a.lastCons[var] = k;
+                // The number of solutions is relative to the largest one among the constraints of the variable, so
+                // the weights neither overflow nor all underflow. Without any solution left, the weights are equal.
+                if (_strategy == AAVGSD_BRANCHING || a.maxLogCount[var] == -infinity)
+                    a.consWeight[var] = 1;
+                else
+                    a.consWeight[var] = std::exp(a.logCounts[k] - a.maxLogCount[var]);
+                a.weight[var] += a.consWeight[var];
+            }
+            score += a.consWeight[var] * d.density;
+        }
+    }
 
-    // We will check if there's a better choice in the other constraints
-    for (int i=cIdx+1; i< _constraints.size(); i++) {
-        if (!_constraints[i]->allAssigned()) {
-            auto posValDensity = _constraints[i]->getDensity(densityComparator);
-            // If this choice is better than the current one...
-            if (densityComparator(posValDensity.density, choice.density)) {
-                cIdx = i;
-                choice = posValDensity;
+    // Highest score, first in the order of the variables and of their values, or a random one of the ties
+    int bestVar = -1, bestVal = 0;
+    double bestScore = 0;
+    unsigned int ties = 0;
+    for (int var = 0; var < _nbVars; var++) {
+        if (a.firstCons[var] < 0)
+            continue;
+        for (IntVarValues val((IntVar)_constraints[a.firstCons[var]]->view(a.firstPos[var])); val(); ++val) {
+            double score = a.score[a.start[var] + val.val() - a.minVal[var]];
+            if (_strategy != MAXRELSD_BRANCHING)
+                score /= a.weight[var];
+            bool better = _options.randomTies ? score > bestScore && !tie(score, bestScore) : score > bestScore;
+            if (bestVar < 0 || better) {
+                bestVar = var;
+                bestVal = val.val();
+                bestScore = score;
+                ties = 1;
+            } else if (_options.randomTies && tie(score, bestScore) && _rnd(++ties) == 0) {
+                bestVar = var;
+                bestVal = val.val();
             }
         }
     }
-    return new CBSPosValChoice<int>(*this, 2, choice.pos, choice.val, cIdx);
+    assert(bestVar >= 0);
+    if (_options.nary || _options.temperature > 0) {
+        a.values.clear();
+        for (IntVarValues val((IntVar)_constraints[a.firstCons[bestVar]]->view(a.firstPos[bestVar])); val(); ++val) {
+            double score = a.score[a.start[bestVar] + val.val() - a.minVal[bestVar]];
+            if (_strategy != MAXRELSD_BRANCHING)
+                score /= a.weight[bestVar];
+            a.values.push_back({a.firstPos[bestVar], val.val(), score});
+        }
+        if (!_options.nary) {
+            CBSPosValDensity drawn = softmaxValue(a.values, false);
+            bestVal = drawn.val;
+            bestScore = drawn.density;
+        } else {
+            std::stable_sort(a.values.begin(), a.values.end(),
+                             [](const CBSPosValDensity &x, const CBSPosValDensity &y) {
+                                 return x.density > y.density;
+                             });
+            return naryChoice(a.firstCons[bestVar], a.firstPos[bestVar], a.values);
+        }
+    }
+    // A score is not a probability: x != v is scored by the best of the other values of the variable
+    double other = -infinity;
+    for (IntVarValues val((IntVar)_constraints[a.firstCons[bestVar]]->view(a.firstPos[bestVar])); val(); ++val) {
+        if (val.val() == bestVal)
+            continue;
+        double score = a.score[a.start[bestVar] + val.val() - a.minVal[bestVar]];
+        if (_strategy != MAXRELSD_BRANCHING)
+            score /= a.weight[bestVar];
+        other = std::max(other, score);
+    }
+    return new CBSPosValChoice<int>(*this, 2, a.firstPos[bestVar], bestVal, a.firstCons[bestVar], bestScore,
+                                    bestScore - other);
 }
 
 const Choice *CBSBrancher::choice(const Space &, Gecode::Archive &e) {
+    if (_options.nary) {
+        unsigned int alternatives;
+        int pos, arrayIdx;
+        e >> alternatives >> pos >> arrayIdx;
+        auto *c = new CBSNaryChoice(*this, alternatives, pos, arrayIdx);
+        for (unsigned int a = 0; a < alternatives; a++) {
+            int val;
+            double density;
+            e >> val >> density;
+            c->set(a, val, density);
+        }
+        return c;
+    }
+
     int pos, val, arrayIdx;
-    e >> pos >> val >> arrayIdx;
-    return new CBSPosValChoice<int>(*this, 2, pos, val, arrayIdx);
+    double density, gap;
+    e >> pos >> val >> arrayIdx >> density >> gap;
+    return new CBSPosValChoice<int>(*this, 2, pos, val, arrayIdx, density, gap);
 }
 
 Gecode::ExecStatus CBSBrancher::commit(Space &home, const Choice &c, unsigned int a) {
+    if (_options.nary) {
+        const CBSNaryChoice &nc = static_cast<const CBSNaryChoice &>(c);
+        return _constraints[nc.arrayIdx()]->eq(home, nc.pos(), nc.val(a));
+    }
+
     const CBSPosValChoice<int> &pvi = static_cast<const CBSPosValChoice<int> &>(c);
-    int pos = pvi.pos().pos, val = pvi.val(), arrayIdx = pvi.arrayIdx();
+    return _constraints[pvi.arrayIdx()]->commit(home, c, a);
+}
+
+NGL *CBSBrancher::ngl(Space &home, const Choice &c, unsigned int a) const {
+    if (_options.nary) {
+        const CBSNaryChoice &nc = static_cast<const CBSNaryChoice &>(c);
+        return _constraints[nc.arrayIdx()]->eqNGL(home, nc.pos(), nc.val(a));
+    }
 
-    _constraints[arrayIdx]->commit(home, c, a);
+    // As Gecode's own x = v / x != v branchers, only the first alternative has a literal.
+    const CBSPosValChoice<int> &pv = static_cast<const CBSPosValChoice<int> &>(c);
+    if (a == 0)
+        return _constraints[pv.arrayIdx()]->eqNGL(home, pv.pos().pos, pv.val());
+    return NULL;
 }
 
 void CBSBrancher::print(const Space &home, const Choice &c, unsigned int a, std::ostream &o) const {
+    if (_options.nary) {
+        const CBSNaryChoice &nc = static_cast<const CBSNaryChoice &>(c);
+        o << "x[" << nc.pos() << "] = " << nc.val(a);
+        return;
+    }
+
     const CBSPosValChoice<int> &pv = static_cast<const CBSPosValChoice<int> &>(c);
     int pos = pv.pos().pos, val = pv.val();
     if (a == 0)
@@ -149,6 +526,11 @@ void CBSBrancher::print(const Space &home, const Choice &c, unsigned int a, std:
 
 void cbsbranch(Space &home, std::vector<CBSConstraint *> &constraints,
                CBSBrancher::Strategy strategy) {
+    cbsbranch(home, constraints, strategy, CBSOptions());
+}
+
+void cbsbranch(Space &home, std::vector<CBSConstraint *> &constraints,
+               CBSBrancher::Strategy strategy, const CBSOptions &options) {
     if (home.failed()) return;
-    CBSBrancher::post(home, constraints, strategy);
+    CBSBrancher::post(home, constraints, strategy, options);
 }
\ No newline at end of file
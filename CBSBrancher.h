@@ -26,29 +26,58 @@
 #include <gecode/minimodel.hh>
 #include <gecode/search.hh>
 
+#include <cmath>
 #include <vector>
 #include "CBSConstraint.hpp"
 
 using namespace Gecode;
 
+// Options of the counting base search brancher
+struct CBSOptions {
+    /**
+     * Threads evaluating the constraints in choice(), the search thread included. With more than 1, the constraints
+     * are evaluated on the shared CBSThreadPool, and so are the variables of large constraints; the choice is the same
+     * as with 1.
+     */
+    unsigned int threads;
+    /**
+     * Branch with one alternative per value of the chosen variable, from the best density to the worst one (see
+     * CBSNaryChoice), instead of x = v and x != v. The variable is chosen once for all its values.
+     */
+    bool nary;
+    /**
+     * Break the ties between the best (variable, value) pairs at random instead of taking the first one, so restarts
+     * explore different trees. Every constraint whose best density ties the choice is then evaluated entirely.
+     */
+    bool randomTies;
+    /**
+     * With a temperature T > 0, the value of the chosen variable is drawn with a probability proportional to
+     * exp(d / T) (exp(-d / T) for MIN_BRANCHING), d being its density (or score), instead of taking the best one.
+     * Not used with nary.
+     */
+    double temperature;
+    // Seed of randomTies and temperature
+    unsigned int seed;
+
+    CBSOptions() : threads(1), nary(false), randomTies(false), temperature(0), seed(1) {}
+};
+
 /**
  * Gestion of all the couting base search constraints.
  *
  * The role of the CBSBrancher is to keep track of all the constraints (via its vector of CBSConstraints). When the
  * brancher is asked for a choice, it computes the estimated solution density for all the pair (variable,value) in all
- * its constraints. It then choose one assignation (variable,value) according to its _densityComparator (for example
- * highest or lowest density).
+ * its constraints. It then choose one assignation (variable,value) according to its _strategy (for example highest or
+ * lowest density).
  */
 class CBSBrancher : public Gecode::Brancher {
 public:
-    enum Strategy {
-        MIN_BRANCHING,
-        MAX_BRANCHING
-    };
+    typedef CBSStrategy Strategy;
 public:
-    CBSBrancher(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy);
+    CBSBrancher(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy, const CBSOptions &options);
 
-    static void post(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy);
+    static void post(Space &home, std::vector<CBSConstraint*> &constraints, Strategy strategy,
+                     const CBSOptions &options);
 
     CBSBrancher(Space &home, bool share, CBSBrancher &b);
 
@@ -62,18 +91,84 @@ public:
 
     virtual ExecStatus commit(Space &home, const Choice &c, unsigned int a);
 
+    // No-good literal of alternative a of c, so restart based search can post no-goods
+    virtual NGL *ngl(Space &home, const Choice &c, unsigned int a) const;
+
     virtual void print(const Space &home, const Choice &c, unsigned int a, std::ostream &o) const;
 
+    // Dispose the constraints and the random numbers, when the brancher is done or its space is deleted
+    virtual size_t dispose(Space &home);
+
+private:
+    /**
+     * Best choice over all the constraints for the comparator Density. Constraints whose density bound can not beat
+     * the current choice are skipped, and the search stops on a density that can not be beaten.
+     *
+     * The constraints are evaluated from the smallest domain size of their unassigned variables, so among equal
+     * densities the choice comes from the constraint with the smallest domain, then from the first constraint: ties
+     * are no longer broken by the order of the constraints alone.
+     */
+    template<class Density>
+    const Choice *bestChoice();
+
+    // Choice of the aggregated strategies, from the densities of all the values in all the constraints
+    const Choice *aggregatedChoice();
+
+    // Densities of the values of the variable at position pos of the constraint cIdx, in increasing order of the values
+    void variableDensities(int cIdx, int pos, std::vector<CBSPosValDensity> &values);
+
+    // N-ary choice for the variable at position pos of the constraint cIdx, ordered by the comparator Density
+    template<class Density>
+    const Choice *naryChoice(int cIdx, int pos);
+
+    // A constraint to evaluate: the smallest domain size of its unassigned variables, its index, and its choice if it
+    // is known without evaluating it (or once evaluated)
+    struct Candidate {
+        unsigned int minSize;
+        int cIdx;
+        bool known;
+        CBSPosValDensity choice;
+    };
+
+    // Replace choice, from the constraint cIdx, by a random pair of the same density among the candidates
+    void randomTie(const std::vector<Candidate> &candidates, int &cIdx, CBSPosValDensity &choice);
+
+    // Pair drawn among values with the temperature of the options, lowest for a lower density is better
+    CBSPosValDensity softmaxValue(const std::vector<CBSPosValDensity> &values, bool lowest);
+
+    // Two densities are a tie for randomTies if they are this close
+    static bool tie(double a, double b) {
+        return std::abs(a - b) <= 1e-12;
+    }
+
+    // N-ary choice for the variable at position pos of the constraint cIdx, with values already ordered
+    const Choice *naryChoice(int cIdx, int pos, const std::vector<CBSPosValDensity> &values);
+
 private:
     // Every counting base search constraints
     using CBSConstraintVector = std::vector<CBSConstraint*, space_allocator<CBSConstraint*>>;
     CBSConstraintVector _constraints;
     // Density selection strategy for branching
     Strategy _strategy;
+    CBSOptions _options;
+    /**
+     * Variables of the constraints, for the aggregated strategies only (null otherwise): the variable at position pos
+     * of the constraint c is the variable _varIndex[_varStart[c] + pos] among the _nbVars variables of the brancher.
+     */
+    int *_varStart;
+    int *_varIndex;
+    int _nbVars;
+    // Constraints before _start have all their variables assigned
+    mutable int _start;
+    // Random numbers of randomTies and temperature
+    Rnd _rnd;
 };
 
 void cbsbranch(Space &home, std::vector<CBSConstraint*> &constraints,
                CBSBrancher::Strategy strategy);
 
+void cbsbranch(Space &home, std::vector<CBSConstraint*> &constraints,
+               CBSBrancher::Strategy strategy, const CBSOptions &options);
+
 
 #endif //CBS_ALLDIFFCBSBRANCHER_H
@@ -23,10 +23,16 @@
 #define CBS_CBSCONSTRAINT_H
 
 #include <gecode/int.hh>
+#include <gecode/int/branch.hh>
 #include <gecode/minimodel.hh>
 #include <gecode/search.hh>
 
-#include <functional>
+#include "CBSDensityCache.h"
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 using namespace Gecode;
 
@@ -36,6 +42,48 @@ struct CBSPosValDensity {
     double density;
 };
 
+/**
+ * Density selection strategy for branching.
+ *
+ * MIN_BRANCHING and MAX_BRANCHING (maxSD) take the lowest or highest density of a (variable, value) pair in any
+ * constraint. The other strategies combine the densities of a variable over all the constraints it appears in:
+ *  - MAXRELSD_BRANCHING: highest density minus 1 / |D(x)|, the density of a uniform distribution,
+ *  - AAVGSD_BRANCHING: highest average density,
+ *  - WSCOUNTING_BRANCHING: highest average density weighted by the number of solutions of the constraints.
+ */
+enum CBSStrategy {
+    MIN_BRANCHING,
+    MAX_BRANCHING,
+    MAXRELSD_BRANCHING,
+    AAVGSD_BRANCHING,
+    WSCOUNTING_BRANCHING
+};
+
+/**
+ * Comparators of the strategies, given as template parameters so the comparisons are inlined in the density
+ * computations. better(a, b) is true when a is a better density to branch on than b.
+ */
+struct CBSMinDensity {
+    static bool better(double a, double b) {
+        return a < b;
+    }
+
+    // No density is better than this one
+    static double best() {
+        return 0;
+    }
+};
+
+struct CBSMaxDensity {
+    static bool better(double a, double b) {
+        return a > b;
+    }
+
+    static double best() {
+        return 1;
+    }
+};
+
 /**
  * Base class for all counting base search constraints.
  *
@@ -44,22 +92,136 @@ struct CBSPosValDensity {
 class CBSConstraint {
 protected:
     ViewArray<Int::IntView> _x;
+    // Threads a constraint may use to compute its densities, see CBSOptions
+    unsigned int _threads;
+private:
+    // Tells apart the constraints in the keys of the density cache, kept by the copies
+    unsigned int _id;
+    /**
+     * Sum of the domain sizes, strategy and choice of the last call to cachedDensity(). They are copied with the space,
+     * and the same sum below means the same domains (see domainChanged()).
+     */
+    unsigned int _lastSize;
+    CBSStrategy _lastStrategy;
+    CBSPosValDensity _lastChoice;
+
+    static unsigned int nextId() {
+        static std::atomic<unsigned int> id(0);
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
 public:
-    CBSConstraint(Space &home, const IntVarArgs &x) {
+    CBSConstraint(Space &home, const IntVarArgs &x)
+            : _threads(1), _id(nextId()), _lastSize(0), _lastStrategy(MAX_BRANCHING), _lastChoice{0, 0, 0} {
         ViewArray<Int::IntView> y(home, x);
         _x = y;
     }
 
-    CBSConstraint(Space &home, bool share, CBSConstraint *c) {
+    CBSConstraint(Space &home, bool share, CBSConstraint *c)
+            : _threads(c->_threads), _id(c->_id), _lastSize(c->_lastSize), _lastStrategy(c->_lastStrategy),
+              _lastChoice(c->_lastChoice) {
         _x.update(home, share, c->_x);
     }
 
     virtual CBSConstraint* copy(Space &home, bool share, CBSConstraint *c) = 0;
 
-    virtual CBSPosValDensity getDensity(std::function<bool(double,double)> comparator) const = 0;
+    // Best (variable, value) pair of the constraint for the strategy
+    virtual CBSPosValDensity getDensity(CBSStrategy strategy) = 0;
+
+    /**
+     * Append the density of every value of every unassigned variable to densities, and return the logarithm of the
+     * (estimated) number of solutions of the constraint. The brancher combines them for the aggregated strategies.
+     */
+    virtual double getDensities(std::vector<CBSPosValDensity> &densities) = 0;
 
     virtual void precomputeDataStruct(int nbVar, int largestDomainSize) {}
 
+    /**
+     * Release what the constraint holds outside of the space memory, such as shared handles. Called once by the owner
+     * of the constraint (CBSBrancher or CBSDensityProvider) when it is deleted, the constraint is not used afterwards.
+     */
+    virtual void dispose(Space &home) {}
+
+    /**
+     * Cheap bound on the density getDensity() returns: it is not better than the bound for the strategy. The brancher
+     * skips the constraints that can not beat its current choice. By default, no density is ruled out.
+     *
+     * The constraints that keep their number of solutions up to date (TableCBS, RegularCBS) bound their highest
+     * density with it, for MAX_BRANCHING. AllDiffCBS has no such bound: a Hall set can force a value whatever the domain sizes, and there
+     * is no cheap lower bound on the permanent.
+     */
+    virtual double densityBound(CBSStrategy strategy) {
+        return strategy == MIN_BRANCHING ? CBSMinDensity::best() : CBSMaxDensity::best();
+    }
+
+    void threads(unsigned int threads) {
+        _threads = threads;
+    }
+
+    /**
+     * Set minSize to the smallest domain size of the unassigned variables. Return true and set choice to the last
+     * choice of cachedDensity() if the constraint is untouched since.
+     */
+    bool lastDensity(CBSStrategy strategy, CBSPosValDensity &choice, unsigned int &minSize) const {
+        unsigned int size = 0;
+        minSize = std::numeric_limits<unsigned int>::max();
+        for (int i = 0; i < _x.size(); i++) {
+            size += _x[i].size();
+            if (!_x[i].assigned())
+                minSize = std::min(minSize, _x[i].size());
+        }
+        if (size == _lastSize && strategy == _lastStrategy) {
+            choice = _lastChoice;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * getDensity() through the density cache of the calling thread. The key is a Zobrist style hash of the ranges of
+     * the domains, the id of the constraint and the strategy.
+     */
+    CBSPosValDensity cachedDensity(CBSStrategy strategy) {
+        // A constraint untouched since its last choice keeps it, without hashing its domains.
+        unsigned int size = 0;
+        for (int i = 0; i < _x.size(); i++)
+            size += _x[i].size();
+        if (size == _lastSize && strategy == _lastStrategy)
+            return _lastChoice;
+
+        CBSPosValDensity choice;
+        if (CBSDensityCache::size() == 0) {
+            choice = getDensity(strategy);
+        } else {
+            unsigned long long key = CBSDensityCache::mix(_id) ^ CBSDensityCache::mix(~(unsigned long long)strategy);
+            for (int i = 0; i < _x.size(); i++) {
+                unsigned long long varKey = CBSDensityCache::mix(i + 1);
+                for (Int::ViewRanges<Int::IntView> r(_x[i]); r(); ++r)
+                    key ^= CBSDensityCache::mix(CBSDensityCache::mix(varKey ^ (unsigned int)r.min()) ^
+                                                (unsigned int)r.max());
+            }
+
+            if (!CBSDensityCache::lookup(key, size, choice)) {
+                choice = getDensity(strategy);
+                CBSDensityCache::store(key, size, choice);
+            }
+        }
+
+        _lastSize = size;
+        _lastStrategy = strategy;
+        _lastChoice = choice;
+        return choice;
+    }
+
+    // Assign the variable at position pos to val
+    ExecStatus eq(Space &home, int pos, int val) {
+        return me_failed(_x[pos].eq(home, val)) ? ES_FAILED : ES_OK;
+    }
+
+    // No-good literal x[pos] = val, for the no-goods of restart based search
+    NGL *eqNGL(Space &home, int pos, int val) const {
+        return new (home) Int::Branch::EqNGL<Int::IntView>(home, _x[pos], val);
+    }
+
     ExecStatus commit(Space &home, const Choice &c, unsigned int a) {
         const PosValChoice<int> &pvi = static_cast<const PosValChoice<int> &>(c);
 
@@ -71,11 +233,81 @@ public:
             return me_failed(_x[pos].nq(home, val)) ? ES_FAILED : ES_OK;
     }
 
+protected:
+    /**
+     * Best pair of densities for the strategy, the first one among equal densities ({-1, 0, 0} if there is none). The
+     * aggregated strategies use getDensities(), on its own a constraint branches on its highest density for them.
+     */
+    static CBSPosValDensity best(CBSStrategy strategy, const std::vector<CBSPosValDensity> &densities) {
+        if (strategy == MIN_BRANCHING)
+            return best<CBSMinDensity>(densities);
+        return best<CBSMaxDensity>(densities);
+    }
+
+    template<class Density>
+    static CBSPosValDensity best(const std::vector<CBSPosValDensity> &densities) {
+        CBSPosValDensity choice = {-1, 0, 0};
+        for (const auto &d : densities)
+            if (choice.pos < 0 || Density::better(d.density, choice.density))
+                choice = d;
+        return choice;
+    }
+
+    /**
+     * Bound on the highest density of a constraint with exp(logCount) solutions: there are at most as many solutions
+     * with x[i] = v as assignments of the other variables, the most for the unassigned variable with the smallest
+     * domain.
+     */
+    double productDensityBound(double logCount) const {
+        if (logCount == -std::numeric_limits<double>::infinity())
+            return 0;
+        double logProduct = 0;
+        unsigned int minSize = std::numeric_limits<unsigned int>::max();
+        for (int i = 0; i < _x.size(); i++) {
+            logProduct += std::log((double)_x[i].size());
+            if (!_x[i].assigned())
+                minSize = std::min(minSize, _x[i].size());
+        }
+        return std::min(1.0, std::exp(logProduct - std::log((double)minSize) - logCount));
+    }
+
+    // Density of a value with count solutions, out of total. Without any solution, all the densities are 0.
+    static double densityOf(double count, double total) {
+        return total > 0 ? count / total : 0;
+    }
+
+    /**
+     * Record the domain size of x[i] in domSize[i] and tell if it changed. Domains only shrink in a branch of the
+     * search tree, so a different size is the only way a variable can change.
+     */
+    bool domainChanged(int *domSize, int i) const {
+        int size = _x[i].size();
+        if (size == domSize[i])
+            return false;
+        domSize[i] = size;
+        return true;
+    }
+
+    /**
+     * Memory of type T for the density computations of a constraint class (its DensityScratch), one per thread. It is
+     * kept between the calls so they do not allocate, and the constraints evaluated in parallel on the CBSThreadPool
+     * do not share it.
+     */
+    template<class T>
+    static T &threadScratch() {
+        thread_local T scratch;
+        return scratch;
+    }
+
 public:
     int size() const {
         return _x.size();
     }
 
+    const Int::IntView &view(int pos) const {
+        return _x[pos];
+    }
+
     bool allAssigned() const {
         return _x.assigned();
     }
@@ -0,0 +1,107 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "CBSDensityCache.h"
+
+#include "CBSConstraint.hpp"
+
+#include <atomic>
+#include <vector>
+
+namespace {
+    struct Entry {
+        unsigned long long key;
+        unsigned int check;
+        // An entry is empty until something is stored in it
+        bool used;
+        CBSPosValDensity choice;
+    };
+
+    std::atomic<unsigned int> tableSize(1 << 14);
+    std::atomic<unsigned long long> hits(0);
+    std::atomic<unsigned long long> misses(0);
+
+    thread_local std::vector<Entry> table;
+
+    // Table of the calling thread, resized if the size changed since the last time it was used. Null if disabled.
+    Entry *threadTable(unsigned int &mask) {
+        unsigned int n = tableSize.load(std::memory_order_relaxed);
+        if (n == 0)
+            return nullptr;
+        if (table.size() != n)
+            table.assign(n, Entry{0, 0, false, {0, 0, 0}});
+        mask = n - 1;
+        return table.data();
+    }
+}
+
+bool CBSDensityCache::lookup(unsigned long long key, unsigned int check, CBSPosValDensity &choice) {
+    unsigned int mask;
+    Entry *t = threadTable(mask);
+    if (t == nullptr)
+        return false;
+
+    const Entry &e = t[key & mask];
+    if (e.used && e.key == key && e.check == check) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        choice = e.choice;
+        return true;
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void CBSDensityCache::store(unsigned long long key, unsigned int check, const CBSPosValDensity &choice) {
+    unsigned int mask;
+    Entry *t = threadTable(mask);
+    if (t == nullptr)
+        return;
+
+    Entry &e = t[key & mask];
+    e.key = key;
+    e.check = check;
+    e.used = true;
+    e.choice = choice;
+}
+
+void CBSDensityCache::size(unsigned int entries) {
+    // Round up to a power of 2 so a slot is found with a mask
+    unsigned int n = 0;
+    if (entries > 0) {
+        n = 1;
+        while (n < entries && n < (1u << 31))
+            n <<= 1;
+    }
+    tableSize.store(n, std::memory_order_relaxed);
+}
+
+unsigned int CBSDensityCache::size() {
+    return tableSize.load(std::memory_order_relaxed);
+}
+
+CBSDensityCache::Statistics CBSDensityCache::statistics() {
+    return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed)};
+}
+
+void CBSDensityCache::resetStatistics() {
+    hits.store(0, std::memory_order_relaxed);
+    misses.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,75 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CBSDENSITYCACHE_H
+#define CBS_CBSDENSITYCACHE_H
+
+struct CBSPosValDensity;
+
+/**
+ * Transposition cache of constraint densities.
+ *
+ * A constraint is often evaluated again on domains it has already seen: after a failed left branch x = v, every
+ * constraint that does not contain x is left exactly as it was in the parent node. The cache maps a hash of the domains
+ * of a constraint (see CBSConstraint::cachedDensity()) to the choice getDensity() returned for them, so such repeated
+ * states skip getDensity() entirely.
+ *
+ * Every thread has its own direct-mapped table of a bounded number of entries, so no locking is needed. A new entry
+ * replaces whatever was in its slot.
+ */
+class CBSDensityCache {
+public:
+    struct Statistics {
+        unsigned long long hits;
+        unsigned long long misses;
+    };
+
+    // Look for the entry of key. Return true and set choice if it is found.
+    static bool lookup(unsigned long long key, unsigned int check, CBSPosValDensity &choice);
+
+    // Keep choice as the entry of key
+    static void store(unsigned long long key, unsigned int check, const CBSPosValDensity &choice);
+
+    /**
+     * Number of entries of the table of every thread, rounded up to a power of 2. 0 disables the cache. Threads resize
+     * their table (and lose its entries) the next time they use it.
+     */
+    static void size(unsigned int entries);
+
+    static unsigned int size();
+
+    // Hits and misses of all threads since the start of the program, or the last reset
+    static Statistics statistics();
+
+    static void resetStatistics();
+
+    // Mix the bits of x (splitmix64 finalizer), used to build the keys.
+    static unsigned long long mix(unsigned long long x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+};
+
+#endif //CBS_CBSDENSITYCACHE_H
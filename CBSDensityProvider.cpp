@@ -0,0 +1,125 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "CBSDensityProvider.h"
+
+#include <algorithm>
+
+CBSDensityProvider::CBSDensityProvider()
+        : _cbsHome(nullptr), _cbsStrategy(MAX_BRANCHING), _bestSize(0), _lastIndex(-1) {}
+
+CBSDensityProvider::CBSDensityProvider(Space &home, bool share, CBSDensityProvider &p)
+        : _cbsHome(&home), _cbsStrategy(p._cbsStrategy), _bestSize(0), _lastIndex(-1) {
+    for (auto c : p._cbsConstraints)
+        _cbsConstraints.push_back(c->copy(home, share, c));
+}
+
+CBSDensityProvider::~CBSDensityProvider() {
+    for (auto c : _cbsConstraints)
+        c->dispose(*_cbsHome);
+}
+
+void CBSDensityProvider::cbsConstraints(Space &home, const std::vector<CBSConstraint*> &constraints,
+                                        CBSStrategy strategy) {
+    assert(strategy == MIN_BRANCHING || strategy == MAX_BRANCHING);
+    _cbsConstraints = constraints;
+    _cbsHome = &home;
+    _cbsStrategy = strategy;
+    _bestSize = 0;
+    _lastIndex = -1;
+    _best.clear();
+
+    // The constraints share their precomputed data structures, as in CBSBrancher.
+    int largestDomainSize = 0;
+    int highestNumberOfVars = 0;
+    for (auto c : _cbsConstraints) {
+        largestDomainSize = std::max(largestDomainSize, c->maxDomValue() - c->minDomValue() + 1);
+        highestNumberOfVars = std::max(highestNumberOfVars, c->size());
+    }
+    for (auto c : _cbsConstraints)
+        c->precomputeDataStruct(highestNumberOfVars, largestDomainSize);
+}
+
+const CBSPosValDensity *CBSDensityProvider::best(IntVar x, bool merit, int i) const {
+    /**
+     * A choice calls the merit function on the unassigned variables of its branching in increasing order of their
+     * index, then possibly the value function. While the variable of the last merit call is unassigned, the next
+     * choice starts again from an index at most its own, or comes from another branching once it is assigned. So a
+     * merit call at a larger index, or a value call, right after it belongs to the same choice, and _best is up to
+     * date. Otherwise, the sum of the domain sizes tells if the domains changed.
+     */
+    bool sameChoice = _lastIndex >= 0 && (!merit || i > _lastIndex) && !_lastVar.assigned();
+    if (merit) {
+        _lastIndex = i;
+        _lastVar = x;
+    } else {
+        _lastIndex = -1;
+    }
+    if (!sameChoice) {
+        unsigned long long size = 0;
+        for (auto c : _cbsConstraints)
+            for (int pos = 0; pos < c->size(); pos++)
+                size += c->view(pos).size();
+
+        if (size != _bestSize) {
+            _bestSize = size;
+            _best.clear();
+            for (auto c : _cbsConstraints) {
+                if (c->allAssigned())
+                    continue;
+                _densities.clear();
+                c->getDensities(_densities);
+                for (const auto &d : _densities) {
+                    auto v = _best.insert({c->view(d.pos).varimp(), d});
+                    CBSPosValDensity &b = v.first->second;
+                    // Among equal densities, the smallest value wins, whatever the order of the constraints.
+                    bool better = _cbsStrategy == MIN_BRANCHING ? CBSMinDensity::better(d.density, b.density)
+                                                                : CBSMaxDensity::better(d.density, b.density);
+                    if (better || (d.density == b.density && d.val < b.val))
+                        b = d;
+                }
+            }
+        }
+    }
+
+    auto b = _best.find(x.varimp());
+    return b == _best.end() ? nullptr : &b->second;
+}
+
+double CBSDensityProvider::cbsMerit(IntVar x, int i) const {
+    const CBSPosValDensity *b = best(x, true, i);
+    if (b == nullptr)
+        return _cbsStrategy == MIN_BRANCHING ? 1 : 0;
+    return b->density;
+}
+
+int CBSDensityProvider::cbsValue(IntVar x) const {
+    const CBSPosValDensity *b = best(x, false, -1);
+    return b == nullptr ? x.min() : b->val;
+}
+
+double cbsmerit(const Space &home, IntVar x, int i) {
+    return dynamic_cast<const CBSDensityProvider &>(home).cbsMerit(x, i);
+}
+
+int cbsval(const Space &home, IntVar x, int) {
+    return dynamic_cast<const CBSDensityProvider &>(home).cbsValue(x);
+}
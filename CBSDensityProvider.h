@@ -0,0 +1,98 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CBSDENSITYPROVIDER_H
+#define CBS_CBSDENSITYPROVIDER_H
+
+#include <gecode/int.hh>
+#include <gecode/minimodel.hh>
+#include <gecode/search.hh>
+
+#include <unordered_map>
+#include <vector>
+#include "CBSConstraint.hpp"
+
+using namespace Gecode;
+
+/**
+ * Densities of CBS constraints for Gecode's own branch().
+ *
+ * A space that inherits from this class exposes the densities of its CBS constraints through cbsmerit() and cbsval(),
+ * so counting base search can choose only the variable or only the value:
+ *
+ *     branch(home, x, INT_VAR_AFC_SIZE_MAX(), INT_VAL(&cbsval));
+ *     branch(home, x, INT_VAR_MERIT_MAX(&cbsmerit), INT_VAL_MIN());
+ *
+ * The densities of a node are computed once, on the first call of either function, and kept until the domains change.
+ * Only MIN_BRANCHING and MAX_BRANCHING are supported: a variable gets the best density of its values in any constraint.
+ */
+class CBSDensityProvider {
+public:
+    CBSDensityProvider();
+
+    // Copy the constraints of p to home, the space being copied
+    CBSDensityProvider(Space &home, bool share, CBSDensityProvider &p);
+
+    // Dispose the constraints, the space must not be deleted yet
+    virtual ~CBSDensityProvider();
+
+    // Constraints of home and strategy giving the densities, set once all the constraints are posted
+    void cbsConstraints(Space &home, const std::vector<CBSConstraint*> &constraints, CBSStrategy strategy);
+
+    /**
+     * Best density of x, the variable at index i of its branching, for the strategy, in any constraint. A variable in
+     * no constraint (or assigned) has the worst density, 1 for MIN_BRANCHING and 0 for MAX_BRANCHING.
+     */
+    double cbsMerit(IntVar x, int i) const;
+
+    // Value of x with the best density, or the minimum of x if it is in no constraint
+    int cbsValue(IntVar x) const;
+private:
+    // Best density of x, or NULL if x has none. merit tells the calls of cbsMerit() apart, with i the index of x.
+    const CBSPosValDensity *best(IntVar x, bool merit, int i) const;
+
+    std::vector<CBSConstraint*> _cbsConstraints;
+    // Space of the constraints, the space inheriting from this class
+    Space *_cbsHome;
+    CBSStrategy _cbsStrategy;
+    /**
+     * Sum of the domain sizes of the constraints when _best was computed. The cache is not copied with the space, and
+     * domains only shrink in a space, so the same sum means the same node.
+     */
+    mutable unsigned long long _bestSize;
+    /**
+     * Index and variable of the last call of cbsMerit(), or -1 if the last call was cbsValue(). Telling that a call
+     * belongs to the same choice as the last one spares summing the domain sizes on every call, see best().
+     */
+    mutable int _lastIndex;
+    mutable IntVar _lastVar;
+    // Best density, and its value, of every unassigned variable of the constraints
+    mutable std::unordered_map<const void*, CBSPosValDensity> _best;
+    mutable std::vector<CBSPosValDensity> _densities;
+};
+
+// Merit function (IntBranchMerit) of the densities, home must inherit from CBSDensityProvider
+double cbsmerit(const Space &home, IntVar x, int i);
+
+// Value function (IntBranchVal) of the densities, home must inherit from CBSDensityProvider
+int cbsval(const Space &home, IntVar x, int i);
+
+#endif //CBS_CBSDENSITYPROVIDER_H
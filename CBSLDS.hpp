@@ -0,0 +1,221 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CBSLDS_H
+#define CBS_CBSLDS_H
+
+#include <gecode/int.hh>
+#include <gecode/minimodel.hh>
+#include <gecode/search.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "CBSNaryChoice.hpp"
+#include "CBSPosValChoice.hpp"
+
+using namespace Gecode;
+
+// Options of the limited discrepancy search
+struct CBSLDSOptions {
+    // Discrepancy added to the limit after every iteration
+    double step;
+    // Largest limit: the search ends after the iteration with this limit
+    double limit;
+
+    CBSLDSOptions() : step(0.25), limit(std::numeric_limits<double>::infinity()) {}
+};
+
+/**
+ * Limited discrepancy search over the densities of the CBSBrancher.
+ *
+ * Taking an alternative costs the gap between its density (or score) and the best one of its choice, in the order
+ * of the strategy of the brancher. A binary choice stores how much better x = v was than x != v when it was made
+ * (see CBSPosValChoice::gap()), and the alternative the strategy prefers is free. An n-ary choice stores the density
+ * of every value, from the best one to the worst one. Alternatives of other branchers cost 0 for the first one and 1
+ * for the others.
+ *
+ * The tree is searched again and again, depth first, with a limit on the total discrepancy of the path growing by
+ * step. An iteration only reports the solutions above the limit of the previous one, so none is found twice, and the
+ * search ends once an iteration did not cut any path (the whole tree was explored).
+ *
+ * Used as Gecode's engines: next() returns the solutions one by one, statistics() and stopped() report on the search.
+ */
+template<class T>
+class CBSLDS {
+public:
+    CBSLDS(T *s, const CBSLDSOptions &options = CBSLDSOptions(), const Search::Options &o = Search::Options::def)
+            : _options(options), _o(o), _pending(nullptr), _limit(0), _previousLimit(-1), _cut(false),
+              _stopped(false) {
+        _root = s->status() == SS_FAILED ? nullptr : s->clone();
+        if (_root != nullptr)
+            start();
+    }
+
+    ~CBSLDS() {
+        clear();
+        delete _pending;
+        delete _root;
+    }
+
+    // Next solution, or null when there is none left or the search is stopped
+    T *next() {
+        _stopped = false;
+        while (_root != nullptr) {
+            if (_pending != nullptr) {
+                T *solution = _pending;
+                _pending = nullptr;
+                return solution;
+            }
+
+            while (!_stack.empty()) {
+                if (_o.stop != nullptr && _o.stop->stop(_stats, _o)) {
+                    _stopped = true;
+                    return nullptr;
+                }
+
+                Node &n = _stack.back();
+                if (n.alt == n.choice->alternatives()) {
+                    delete n.choice;
+                    delete n.space;
+                    _stack.pop_back();
+                    continue;
+                }
+
+                unsigned int a = n.alt++;
+                double cost = n.cost + discrepancy(*n.choice, a);
+                if (cost > _limit + tolerance) {
+                    _cut = true;
+                    continue;
+                }
+
+                // The last alternative takes the space of the node, the others a clone
+                Space *child;
+                if (n.alt == n.choice->alternatives()) {
+                    child = n.space;
+                    n.space = nullptr;
+                } else {
+                    child = n.space->clone();
+                }
+                child->commit(*n.choice, a);
+                _stats.node++;
+
+                if (T *solution = expand(child, cost))
+                    return solution;
+            }
+
+            // A new iteration if the last one cut some paths
+            if (!_cut || _limit >= _options.limit) {
+                delete _root;
+                _root = nullptr;
+                break;
+            }
+            _previousLimit = _limit;
+            _limit = std::min(_limit + _options.step, _options.limit);
+            _stats.restart++;
+            start();
+        }
+        return nullptr;
+    }
+
+    Search::Statistics statistics() const {
+        return _stats;
+    }
+
+    bool stopped() const {
+        return _stopped;
+    }
+
+    // Limit on the discrepancy of the current iteration
+    double limit() const {
+        return _limit;
+    }
+
+    // Discrepancy of alternative a of c
+    static double discrepancy(const Choice &c, unsigned int a) {
+        if (auto pv = dynamic_cast<const CBSPosValChoice<int>*>(&c))
+            return std::max(0.0, a == 0 ? -pv->gap() : pv->gap());
+        if (auto nc = dynamic_cast<const CBSNaryChoice*>(&c))
+            return std::abs(nc->density(0) - nc->density(a));
+        return a == 0 ? 0 : 1;
+    }
+private:
+    // A space, its choice, the next alternative to take and the discrepancy of the path to the space
+    struct Node {
+        Space *space;
+        const Choice *choice;
+        unsigned int alt;
+        double cost;
+    };
+
+    // Densities are floating point: paths this close to the limit are within it.
+    static constexpr double tolerance = 1e-9;
+
+    // Start an iteration from the root, a solved root is kept in _pending
+    void start() {
+        _cut = false;
+        _pending = expand(_root->clone(), 0);
+    }
+
+    // Push s on the stack if it branches. Return s if it is a solution new to this iteration, delete it otherwise.
+    T *expand(Space *s, double cost) {
+        switch (s->status()) {
+            case SS_FAILED:
+                _stats.fail++;
+                delete s;
+                return nullptr;
+            case SS_SOLVED:
+                if (cost > _previousLimit + tolerance)
+                    return static_cast<T*>(s);
+                delete s;
+                return nullptr;
+            case SS_BRANCH:
+                _stack.push_back({s, s->choice(), 0, cost});
+                _stats.depth = std::max(_stats.depth, (unsigned long int)_stack.size());
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    void clear() {
+        for (auto &n : _stack) {
+            delete n.choice;
+            delete n.space;
+        }
+        _stack.clear();
+    }
+
+    CBSLDSOptions _options;
+    Search::Options _o;
+    Search::Statistics _stats;
+    Space *_root;
+    // Solution found by start(), returned by the next call to next()
+    T *_pending;
+    std::vector<Node> _stack;
+    double _limit;
+    double _previousLimit;
+    // Whether the current iteration cut a path above the limit
+    bool _cut;
+    bool _stopped;
+};
+
+#endif //CBS_CBSLDS_H
@@ -0,0 +1,88 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CBSNARYCHOICE_H
+#define CBS_CBSNARYCHOICE_H
+
+#include <gecode/int.hh>
+#include <gecode/minimodel.hh>
+#include <gecode/search.hh>
+
+using namespace Gecode;
+
+/**
+ * N-ary choice of the CBSBrancher: alternative a assigns the variable at position pos of the constraint arrayIdx to
+ * val(a). The values are those of the domain of the variable, ordered from the best density to the worst one, so the
+ * variable is chosen once for all its values.
+ */
+class GECODE_VTABLE_EXPORT CBSNaryChoice : public Choice {
+private:
+    const int _pos;
+    const int _arrayIdx;
+    int *_vals;
+    double *_densities;
+public:
+    CBSNaryChoice(const Brancher &b, unsigned int a, int pos, int arrayIdx)
+            : Choice(b, a), _pos(pos), _arrayIdx(arrayIdx) {
+        _vals = heap.alloc<int>(a);
+        _densities = heap.alloc<double>(a);
+    }
+
+    virtual ~CBSNaryChoice() {
+        heap.free(_vals, alternatives());
+        heap.free(_densities, alternatives());
+    }
+
+    int pos() const {
+        return _pos;
+    }
+
+    int arrayIdx() const {
+        return _arrayIdx;
+    }
+
+    int val(unsigned int a) const {
+        return _vals[a];
+    }
+
+    // Density (or score) of the value of alternative a when the choice was made
+    double density(unsigned int a) const {
+        return _densities[a];
+    }
+
+    void set(unsigned int a, int val, double density) {
+        _vals[a] = val;
+        _densities[a] = density;
+    }
+
+    virtual size_t size() const {
+        return sizeof(CBSNaryChoice) + alternatives() * (sizeof(int) + sizeof(double));
+    }
+
+    virtual void archive(Archive &e) const {
+        Choice::archive(e);
+        e << alternatives() << _pos << _arrayIdx;
+        for (unsigned int a = 0; a < alternatives(); a++)
+            e << _vals[a] << _densities[a];
+    }
+};
+
+#endif //CBS_CBSNARYCHOICE_H
@@ -33,21 +33,34 @@ template<class Val>
 class GECODE_VTABLE_EXPORT CBSPosValChoice : public PosValChoice<Val> {
 private:
     const int _arrayIdx;
+    // Density (or score) of x = val when the choice was made
+    const double _density;
+    // How much better x = val was than x != val for the strategy of the brancher (negative if x != val was better)
+    const double _gap;
 public:
-    CBSPosValChoice(const Brancher& b, unsigned int a, const Pos& p, const Val& n, int arrayIdx)
-        : PosValChoice<Val>(b,a,p,n), _arrayIdx(arrayIdx) {}
+    CBSPosValChoice(const Brancher& b, unsigned int a, const Pos& p, const Val& n, int arrayIdx, double density,
+                    double gap)
+        : PosValChoice<Val>(b,a,p,n), _arrayIdx(arrayIdx), _density(density), _gap(gap) {}
 
     int arrayIdx(void) const {
         return _arrayIdx;
     }
 
+    double density(void) const {
+        return _density;
+    }
+
+    double gap(void) const {
+        return _gap;
+    }
+
     virtual size_t size(void) const {
         return sizeof(CBSPosValChoice<Val>);
     }
 
     virtual void archive(Archive& e) const {
         PosValChoice<Val>::archive(e);
-        e << _arrayIdx;
+        e << _arrayIdx << _density << _gap;
     }
 
 };
@@ -0,0 +1,111 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "CBSThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+    // Set while the thread runs tasks of the pool, so the tasks that use the pool run their jobs in their thread.
+    thread_local bool inPool = false;
+}
+
+CBSThreadPool &CBSThreadPool::pool() {
+    static CBSThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return pool;
+}
+
+CBSThreadPool::CBSThreadPool(unsigned int nbWorkers)
+        : _busy(false), _stop(false), _generation(0), _task(nullptr), _nbTasks(0), _next(0),
+          _nbHelpers(0), _running(0) {
+    _workers.reserve(nbWorkers);
+    for (unsigned int i = 0; i < nbWorkers; i++)
+        _workers.emplace_back(&CBSThreadPool::work, this, i);
+}
+
+CBSThreadPool::~CBSThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &w : _workers)
+        w.join();
+}
+
+void CBSThreadPool::run(int n, unsigned int nbThreads, const std::function<void(int)> &task) {
+    bool expected = false;
+    if (n <= 1 || nbThreads <= 1 || _workers.empty() || inPool ||
+        !_busy.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        for (int i = 0; i < n; i++)
+            task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _nbTasks = n;
+        _next.store(0, std::memory_order_relaxed);
+        _nbHelpers = std::min<unsigned int>({nbThreads - 1, (unsigned int)_workers.size(), (unsigned int)n - 1});
+        _running = _nbHelpers;
+        _generation++;
+    }
+    _wake.notify_all();
+
+    inPool = true;
+    runTasks();
+    inPool = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _running == 0; });
+        _task = nullptr;
+    }
+    _busy.store(false, std::memory_order_release);
+}
+
+void CBSThreadPool::work(unsigned int index) {
+    inPool = true;
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop)
+            return;
+        seen = _generation;
+        // Only the first workers take part in a job that needs fewer threads than the pool has
+        if (index >= _nbHelpers)
+            continue;
+
+        lock.unlock();
+        runTasks();
+        lock.lock();
+        if (--_running == 0)
+            _done.notify_one();
+    }
+}
+
+void CBSThreadPool::runTasks() {
+    for (int i = _next.fetch_add(1, std::memory_order_relaxed); i < _nbTasks;
+         i = _next.fetch_add(1, std::memory_order_relaxed))
+        (*_task)(i);
+}
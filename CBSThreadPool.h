@@ -0,0 +1,90 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CBSTHREADPOOL_H
+#define CBS_CBSTHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed pool of worker threads for the density computations.
+ *
+ * The workers are started once, the first time the pool is used, and wait for jobs. A job is a number of tasks given
+ * to run(): the calling thread and the workers take the tasks one at a time from a shared counter, so threads that
+ * finish early take over the remaining tasks and no thread is ever created for a job.
+ *
+ * Tasks must not allocate in a space: space memory is not thread-safe.
+ */
+class CBSThreadPool {
+public:
+    // Pool of the program, with a worker for every core but one
+    static CBSThreadPool &pool();
+
+    ~CBSThreadPool();
+
+    // Number of threads that can run the tasks of a job, the calling thread included
+    unsigned int size() const {
+        return _workers.size() + 1;
+    }
+
+    /**
+     * Run task(i) for i in 0..n-1 on at most nbThreads threads, the calling thread included, and return once all of
+     * them are done. When the pool is running another job (from another search thread, or from a task of this one),
+     * the tasks are run in the calling thread.
+     */
+    void run(int n, unsigned int nbThreads, const std::function<void(int)> &task);
+
+private:
+    explicit CBSThreadPool(unsigned int nbWorkers);
+
+    // Loop of the worker at index
+    void work(unsigned int index);
+
+    // Take and run tasks of the current job until there are none left
+    void runTasks();
+
+private:
+    std::vector<std::thread> _workers;
+    // Set by the thread whose job is running
+    std::atomic<bool> _busy;
+
+    // Guards the fields of the current job below, except _next
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    bool _stop;
+    // Incremented for every job, so the workers can tell a new job from a spurious wake up
+    unsigned long long _generation;
+
+    // Current job: its tasks, the next task to run, and the workers taking part in it that are not done yet
+    const std::function<void(int)> *_task;
+    int _nbTasks;
+    std::atomic<int> _next;
+    unsigned int _nbHelpers;
+    unsigned int _running;
+};
+
+#endif //CBS_CBSTHREADPOOL_H
@@ -0,0 +1,123 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "ChannelCBS.h"
+
+#include <limits>
+#include <vector>
+
+struct ChannelCBS::DensityScratch {
+    // Densities of x and y
+    std::vector<CBSPosValDensity> table;
+    // Sum of the densities passed to every y[j]
+    std::vector<double> ySum;
+};
+
+IntVarArgs ChannelCBS::scope(const IntVarArgs &x, const IntVarArgs &y) {
+    IntVarArgs vars(x.size() + y.size());
+    for (int i = 0; i < x.size(); i++)
+        vars[i] = x[i];
+    for (int j = 0; j < y.size(); j++)
+        vars[x.size() + j] = y[j];
+    return vars;
+}
+
+ChannelCBS::ChannelCBS(Space &home, const IntVarArgs &x, const IntVarArgs &y, int exactThreshold)
+        : CBSConstraint(home, scope(x, y)), _n(x.size()) {
+    assert(x.size() == y.size());
+    char *mem = home.alloc<char>(sizeof(AllDiffCBS));
+    _permutation = new (mem) AllDiffCBS(home, x, exactThreshold);
+}
+
+ChannelCBS::ChannelCBS(Space &home, bool share, ChannelCBS *c)
+        : CBSConstraint(home, share, c), _n(c->_n) {
+    _permutation = static_cast<AllDiffCBS*>(c->_permutation->copy(home, share, c->_permutation));
+}
+
+CBSConstraint *ChannelCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(ChannelCBS));
+    auto ret = new (mem) ChannelCBS(home, share, static_cast<ChannelCBS*>(c));
+    return ret;
+}
+
+void ChannelCBS::precomputeDataStruct(int nbVar, int largestDomainSize) {
+    _permutation->precomputeDataStruct(nbVar, largestDomainSize);
+}
+
+void ChannelCBS::dispose(Space &home) {
+    _permutation->dispose(home);
+}
+
+CBSPosValDensity ChannelCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    // Once scaled, a density on y may be better than all the ones on x.
+    auto &table = threadScratch<DensityScratch>().table;
+    table.clear();
+    getDensities(table);
+    return best(strategy, table);
+}
+
+double ChannelCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    if (_permutation->allAssigned())
+        return inverseDensities(densities);
+
+    _permutation->threads(_threads);
+    size_t first = densities.size();
+    double logCount = _permutation->getDensities(densities);
+    size_t last = densities.size();
+    for (size_t k = first; k < last; k++) {
+        CBSPosValDensity d = densities[k];
+        if (d.val < 0 || d.val >= _n)
+            continue;
+        const Int::IntView &y = _x[_n + d.val];
+        if (!y.assigned() && y.in(d.pos))
+            densities.push_back({_n + d.val, d.pos, d.density});
+    }
+
+    // Exact counts already sum to 1 over the values of y[j], the upper bounds do not.
+    auto &ySum = threadScratch<DensityScratch>().ySum;
+    ySum.assign(_n, 0);
+    for (size_t k = last; k < densities.size(); k++)
+        ySum[densities[k].pos - _n] += densities[k].density;
+    for (size_t k = last; k < densities.size(); k++)
+        densities[k].density = densityOf(densities[k].density, ySum[densities[k].pos - _n]);
+    return logCount;
+}
+
+double ChannelCBS::inverseDensities(std::vector<CBSPosValDensity> &densities) const {
+    bool solution = true;
+    for (int j = 0; j < _n; j++) {
+        const Int::IntView &y = _x[_n + j];
+        if (y.assigned())
+            continue;
+        bool found = false;
+        for (IntVarValues i((IntVar)y); i(); ++i) {
+            bool inverse = i.val() >= 0 && i.val() < _n && _x[i.val()].val() == j;
+            densities.push_back({_n + j, i.val(), inverse ? 1.0 : 0.0});
+            found |= inverse;
+        }
+        solution &= found;
+    }
+    return solution ? 0 : -std::numeric_limits<double>::infinity();
+}
@@ -0,0 +1,75 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_CHANNELCBS_H
+#define CBS_CHANNELCBS_H
+
+#include <vector>
+#include "AllDiffCBS.h"
+#include "CBSConstraint.hpp"
+
+/**
+ * Channel couting base search constraint, the counterpart of Gecode's channel(home, x, y): x[i] = j if and only if
+ * y[j] = i, the values starting at 0.
+ *
+ * The solutions are the permutations x, y being its inverse, so they are counted by an AllDiffCBS on x (exact for
+ * small components, upper bounds otherwise). The density of x[i] = j is also the density of y[j] = i, the same
+ * solutions: the densities computed on x are passed to y, scaled to sum to 1 over the values of every y[j] as the
+ * upper bounds only do over the values of every x[i]. The domains of y are only used through x, which is exact as
+ * long as the channel is propagated with ICL_DOM, so that j is in D(x[i]) if and only if i is in D(y[j]).
+ */
+class ChannelCBS : public CBSConstraint {
+public:
+    ChannelCBS(Space &home, const IntVarArgs &x, const IntVarArgs &y, int exactThreshold = 8);
+
+    ChannelCBS(Space &home, bool share, ChannelCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+    void precomputeDataStruct(int nbVar, int largestDomainSize) override;
+
+    void dispose(Space &home) override;
+
+private:
+    // The variables are x then y
+    static IntVarArgs scope(const IntVarArgs &x, const IntVarArgs &y);
+
+    /**
+     * Densities of y once x is assigned, which leaves one value to each y[j], appended to densities. Returns the
+     * logarithm of the number of solutions, 0 or -infinity.
+     */
+    double inverseDensities(std::vector<CBSPosValDensity> &densities) const;
+
+    // Memory of getDensity(), see ChannelCBS.cpp
+    struct DensityScratch;
+
+private:
+    // Number of variables of x, and of y
+    int _n;
+    // Permutation x, in the same space as the constraint
+    AllDiffCBS *_permutation;
+};
+
+#endif //CBS_CHANNELCBS_H
@@ -0,0 +1,155 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "ElementCBS.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+struct ElementCBS::DensityScratch {
+    // Densities of the values of the unassigned variables
+    std::vector<CBSPosValDensity> table;
+    // Weight w[i] of every index of x (see ElementCBS.h)
+    std::vector<double> weight;
+    // Values of y in increasing order, and sum of 1 / |D(x[i])| for every one of them
+    std::vector<int> yVals;
+    std::vector<double> yWeight;
+};
+
+IntVarArgs ElementCBS::scope(IntVar idx, IntVar y, const IntVarArgs &x) {
+    IntVarArgs vars(x.size() + xPos);
+    vars[idxPos] = idx;
+    vars[yPos] = y;
+    for (int i = 0; i < x.size(); i++)
+        vars[xPos + i] = x[i];
+    return vars;
+}
+
+IntVarArgs ElementCBS::constants(Space &home, const IntArgs &c) {
+    IntVarArgs x(c.size());
+    for (int i = 0; i < c.size(); i++)
+        x[i] = IntVar(home, c[i], c[i]);
+    return x;
+}
+
+ElementCBS::ElementCBS(Space &home, const IntVarArgs &x, IntVar idx, IntVar y)
+        : CBSConstraint(home, scope(idx, y, x)) {}
+
+ElementCBS::ElementCBS(Space &home, const IntArgs &c, IntVar idx, IntVar y)
+        : CBSConstraint(home, scope(idx, y, constants(home, c))) {}
+
+ElementCBS::ElementCBS(Space &home, bool share, ElementCBS *c)
+        : CBSConstraint(home, share, c) {}
+
+CBSConstraint *ElementCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(ElementCBS));
+    auto ret = new (mem) ElementCBS(home, share, static_cast<ElementCBS*>(c));
+    return ret;
+}
+
+CBSPosValDensity ElementCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    computeDensities();
+    return best(strategy, threadScratch<DensityScratch>().table);
+}
+
+double ElementCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    double logCount = computeDensities();
+    const auto &table = threadScratch<DensityScratch>().table;
+    densities.insert(densities.end(), table.begin(), table.end());
+    return logCount;
+}
+
+double ElementCBS::computeDensities() const {
+    auto &s = threadScratch<DensityScratch>();
+    s.table.clear();
+    const Int::IntView &idx = _x[idxPos];
+    const Int::IntView &y = _x[yPos];
+    int n = _x.size() - xPos;
+
+    // Weights of the indices, and the logarithm of the product of the domain sizes of x
+    double logProduct = 0;
+    for (int i = 0; i < n; i++)
+        logProduct += std::log((double)_x[xPos + i].size());
+    double total = 0;
+    s.weight.assign(n, 0);
+    for (IntVarValues i((IntVar)idx); i(); ++i) {
+        if (i.val() < 0 || i.val() >= n)
+            continue;
+        const Int::IntView &xi = _x[xPos + i.val()];
+        int common = 0;
+        for (IntVarValues v((IntVar)xi); v(); ++v)
+            common += y.in(v.val());
+        s.weight[i.val()] = (double)common / xi.size();
+        total += s.weight[i.val()];
+    }
+
+    if (!idx.assigned())
+        for (IntVarValues i((IntVar)idx); i(); ++i) {
+            double w = i.val() >= 0 && i.val() < n ? s.weight[i.val()] : 0;
+            s.table.push_back({idxPos, i.val(), densityOf(w, total)});
+        }
+
+    // y = v in the solutions of every index i with v in D(x[i]), one assignment of x[i] out of |D(x[i])|
+    if (!y.assigned()) {
+        // Indexed by the rank of the value in D(y), found by merging D(y) with every D(x[i])
+        s.yVals.clear();
+        for (IntVarValues v((IntVar)y); v(); ++v)
+            s.yVals.push_back(v.val());
+        s.yWeight.assign(s.yVals.size(), 0);
+        for (int i = 0; i < n; i++) {
+            if (s.weight[i] == 0)
+                continue;
+            const Int::IntView &xi = _x[xPos + i];
+            size_t r = 0;
+            for (IntVarValues v((IntVar)xi); v() && r < s.yVals.size(); ++v) {
+                while (r < s.yVals.size() && s.yVals[r] < v.val())
+                    r++;
+                if (r < s.yVals.size() && s.yVals[r] == v.val())
+                    s.yWeight[r] += 1.0 / xi.size();
+            }
+        }
+        for (size_t r = 0; r < s.yVals.size(); r++)
+            s.table.push_back({yPos, s.yVals[r], densityOf(s.yWeight[r], total)});
+    }
+
+    /**
+     * x[j] = v divides the solutions of the other indices by |D(x[j])|. With idx = j, there is one solution for
+     * v in D(y), and none otherwise.
+     */
+    for (int j = 0; j < n; j++) {
+        const Int::IntView &xj = _x[xPos + j];
+        if (xj.assigned())
+            continue;
+        double other = (total - s.weight[j]) / xj.size();
+        bool indexed = s.weight[j] > 0;
+        for (IntVarValues v((IntVar)xj); v(); ++v) {
+            double count = other + (indexed && y.in(v.val()) ? 1.0 / xj.size() : 0);
+            s.table.push_back({xPos + j, v.val(), densityOf(count, total)});
+        }
+    }
+
+    return total > 0 ? logProduct + std::log(total) : -std::numeric_limits<double>::infinity();
+}
@@ -0,0 +1,74 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_ELEMENTCBS_H
+#define CBS_ELEMENTCBS_H
+
+#include <vector>
+#include "CBSConstraint.hpp"
+
+/**
+ * Element couting base search constraint, the counterpart of Gecode's element(home, x, idx, y): x[idx] = y, the
+ * indices starting at 0.
+ *
+ * The densities are exact, from the number of supports of every value. With idx = i, the solutions are the values of
+ * D(y) ∩ D(x[i]) times the assignments of the other variables of x, so up to the product P of the domain sizes of x,
+ * there are w[i] = |D(y) ∩ D(x[i])| / |D(x[i])| of them, and P (w[0] + ... + w[n-1]) solutions in all (w[i] = 0 for the
+ * indices out of D(idx)). A variable appearing twice, such as y in x, makes the counts approximate.
+ */
+class ElementCBS : public CBSConstraint {
+public:
+    ElementCBS(Space &home, const IntVarArgs &x, IntVar idx, IntVar y);
+
+    // Array of constants, given to the constraint as assigned variables
+    ElementCBS(Space &home, const IntArgs &c, IntVar idx, IntVar y);
+
+    ElementCBS(Space &home, bool share, ElementCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+private:
+    // The variables are idx, y and x, in this order
+    static IntVarArgs scope(IntVar idx, IntVar y, const IntVarArgs &x);
+
+    // Assigned variables for the constants c
+    static IntVarArgs constants(Space &home, const IntArgs &c);
+
+    /**
+     * Density of every value of every unassigned variable, left in the scratch memory in the order of the variables
+     * and of their values. Returns the logarithm of the number of solutions.
+     */
+    double computeDensities() const;
+
+    // Memory of getDensity(), see ElementCBS.cpp
+    struct DensityScratch;
+
+    // Positions of idx, y and x[0] in _x
+    static const int idxPos = 0;
+    static const int yPos = 1;
+    static const int xPos = 2;
+};
+
+#endif //CBS_ELEMENTCBS_H
@@ -0,0 +1,253 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "GccCBS.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+    // Minc and Brégman factor log(n!) / n of a row of n ones, 0 for an empty row
+    double minc(int n) {
+        return n == 0 ? 0 : std::lgamma(n + 1.0) / n;
+    }
+}
+
+struct GccCBS::DensityScratch {
+    // Remaining capacity of every value (minus _minVal), and whether an unassigned variable can take it
+    std::vector<int> capacity;
+    std::vector<char> used;
+    // Degree of every variable in the replicated graph
+    std::vector<int> degree;
+    /**
+     * Change of the bound when a replica of a value is removed, over the variables that can take it: the finite part,
+     * and the number of variables left without any replica (the bound is then 0).
+     */
+    std::vector<double> valMinc;
+    std::vector<int> valEmptied;
+    // Values of a variable and their bounds
+    std::vector<int> vals;
+    std::vector<double> bounds;
+};
+
+GccCBS::GccCBS(Space &home, const IntVarArgs &x, const IntSetArgs &c, const IntArgs &v)
+        : CBSConstraint(home, x) {
+    assert(c.size() == v.size());
+    std::vector<int> maxCard(v.size());
+    for (int k = 0; k < v.size(); k++)
+        maxCard[k] = c[k].max();
+    init(home, v, maxCard);
+}
+
+GccCBS::GccCBS(Space &home, const IntVarArgs &x, const IntSet &c, const IntArgs &v)
+        : CBSConstraint(home, x) {
+    init(home, v, std::vector<int>(v.size(), c.max()));
+}
+
+GccCBS::GccCBS(Space &home, bool share, GccCBS *c)
+        : CBSConstraint(home, share, c), _minVal(c->_minVal), _nbVal(c->_nbVal) {
+    _capacity = home.alloc<int>(_nbVal);
+    std::copy(c->_capacity, c->_capacity + _nbVal, _capacity);
+}
+
+CBSConstraint *GccCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(GccCBS));
+    auto ret = new (mem) GccCBS(home, share, static_cast<GccCBS*>(c));
+    return ret;
+}
+
+void GccCBS::init(Space &home, const IntArgs &v, const std::vector<int> &maxCard) {
+    _minVal = std::min(minDomValue(), *std::min_element(v.begin(), v.end()));
+    _nbVal = std::max(maxDomValue(), *std::max_element(v.begin(), v.end())) - _minVal + 1;
+    _capacity = home.alloc<int>(_nbVal);
+    std::fill(_capacity, _capacity + _nbVal, 0);
+    // No value is taken by more than all the variables
+    for (int k = 0; k < v.size(); k++)
+        _capacity[v[k] - _minVal] = std::max(0, std::min(maxCard[k], _x.size()));
+}
+
+CBSPosValDensity GccCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    prepareDensities();
+    switch (strategy) {
+        case MIN_BRANCHING:
+            return bestDensity<CBSMinDensity>();
+        default:
+            // As AllDiffCBS, the aggregated strategies use getDensities(), on its own the constraint branches on its
+            // highest density.
+            return bestDensity<CBSMaxDensity>();
+    }
+}
+
+double GccCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    double logCount = prepareDensities();
+    auto &s = threadScratch<DensityScratch>();
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        varBounds(i);
+        int nbVals = _x[i].size();
+        double maxBound = *std::max_element(s.bounds.begin(), s.bounds.begin() + nbVals);
+        double normalization = 0;
+        if (maxBound != -std::numeric_limits<double>::infinity())
+            for (int k = 0; k < nbVals; k++)
+                normalization += std::exp(s.bounds[k] - maxBound);
+        for (int k = 0; k < nbVals; k++) {
+            double density = normalization == 0 ? 0 : std::exp(s.bounds[k] - maxBound) / normalization;
+            densities.push_back({i, s.vals[k], density});
+        }
+    }
+    return logCount;
+}
+
+double GccCBS::prepareDensities() const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+    s.capacity.assign(_capacity, _capacity + _nbVal);
+    s.used.assign(_nbVal, false);
+    s.degree.assign(_x.size(), 0);
+    s.valMinc.assign(_nbVal, 0);
+    s.valEmptied.assign(_nbVal, 0);
+
+    // The assigned variables use a unit of the capacity of their value. A value taken too often means there is no
+    // solution left to count, its capacity stays 0.
+    bool solvable = true;
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned()) {
+            int &capacity = s.capacity[_x[i].val() - _minVal];
+            if (capacity == 0)
+                solvable = false;
+            else
+                capacity--;
+        }
+    }
+
+    // Degree of the unassigned variables: one edge per replica of every value of their domain
+    int nbUnassigned = 0;
+    double logCount = 0;
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        nbUnassigned++;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            s.degree[i] += s.capacity[val.val() - _minVal];
+            s.used[val.val() - _minVal] = true;
+        }
+        if (s.degree[i] == 0)
+            solvable = false;
+        logCount += minc(s.degree[i]);
+    }
+
+    // Effect of removing a replica of a value on the variables that can take it
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            if (s.degree[i] > 1)
+                s.valMinc[val.val() - _minVal] += minc(s.degree[i] - 1) - minc(s.degree[i]);
+            else
+                s.valEmptied[val.val() - _minVal]++;
+        }
+    }
+
+    /**
+     * A solution is a perfect matching for every order of the replicas of the values, at least: the fake variables
+     * take the replicas left by the unassigned variables, which gives even more matchings. Dividing by the orders of
+     * the replicas keeps an upper bound on the number of solutions.
+     */
+    int nbReplicas = 0;
+    for (int v = 0; v < _nbVal; v++) {
+        if (s.used[v]) {
+            nbReplicas += s.capacity[v];
+            logCount -= std::lgamma(s.capacity[v] + 1.0);
+        }
+    }
+    int nbFake = nbReplicas - nbUnassigned;
+    if (nbFake < 0 || !solvable)
+        return -infinity;
+    return logCount + nbFake * minc(nbReplicas);
+}
+
+void GccCBS::varBounds(int i) const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+    s.vals.resize(_x[i].size());
+    s.bounds.resize(_x[i].size());
+
+    /**
+     * With x[i] = v, the row of x[i] and a replica of v leave the graph; the row of x[i] and the fake rows change the
+     * bound the same way for all the values, so they cancel out in the normalization. Any of the replicas of v can be
+     * matched to x[i]. The value sums include x[i] itself, which is taken back here.
+     */
+    double ownMinc = s.degree[i] > 1 ? minc(s.degree[i] - 1) - minc(s.degree[i]) : 0;
+    int ownEmptied = s.degree[i] > 1 ? 0 : 1;
+    int k = 0;
+    for (IntVarValues val((IntVar)_x[i]); val(); ++val, k++) {
+        int v = val.val() - _minVal;
+        s.vals[k] = val.val();
+        if (s.capacity[v] == 0 || s.valEmptied[v] - ownEmptied > 0)
+            s.bounds[k] = -infinity;
+        else
+            s.bounds[k] = std::log(s.capacity[v]) + s.valMinc[v] - ownMinc;
+    }
+}
+
+template<class Density>
+CBSPosValDensity GccCBS::bestDensity() const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+    CBSPosValDensity choice = {-1, 0, 0};
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        varBounds(i);
+        int nbVals = _x[i].size();
+        int argMax = 0, argMin = 0;
+        for (int k = 1; k < nbVals; k++) {
+            if (s.bounds[k] > s.bounds[argMax])
+                argMax = k;
+            if (s.bounds[k] < s.bounds[argMin])
+                argMin = k;
+        }
+
+        // If the largest bound is -inf, no value of the variable has a solution and all its densities are 0.
+        double maxDensity = 0, minDensity = 0;
+        if (s.bounds[argMax] != -infinity) {
+            double normalization = 0;
+            for (int k = 0; k < nbVals; k++)
+                normalization += std::exp(s.bounds[k] - s.bounds[argMax]);
+            maxDensity = 1 / normalization;
+            minDensity = std::exp(s.bounds[argMin] - s.bounds[argMax]) / normalization;
+        }
+
+        // Only one of the extreme densities of the variable can be a better choice than our current one.
+        bool min = Density::better(minDensity, maxDensity);
+        double density = min ? minDensity : maxDensity;
+        if (choice.pos < 0 || Density::better(density, choice.density))
+            choice = {i, s.vals[min ? argMin : argMax], density};
+    }
+    return choice;
+}
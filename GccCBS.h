@@ -0,0 +1,79 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_GCCCBS_H
+#define CBS_GCCCBS_H
+
+#include <vector>
+#include "CBSConstraint.hpp"
+
+/**
+ * Global cardinality couting base search constraint, the counterpart of Gecode's count(home, x, c, v): the variables
+ * take the values of v, value v[k] being taken by at most c[k].max() of them.
+ *
+ * As in "Counting-Based Search: Branching Heuristics for Constraint Satisfaction Problems" (Pesant, Quimper and
+ * Zanarini), the solutions are counted in the value-replicated bipartite graph: every value appears once per remaining
+ * unit of its capacity, and fake variables adjacent to every replica make the graph square. The densities come from
+ * the Minc and Brégman upper bound on its permanent. The lower cardinalities are not used by the bound.
+ */
+class GccCBS : public CBSConstraint {
+public:
+    GccCBS(Space &home, const IntVarArgs &x, const IntSetArgs &c, const IntArgs &v);
+
+    // Same cardinality c for all the values of v
+    GccCBS(Space &home, const IntVarArgs &x, const IntSet &c, const IntArgs &v);
+
+    GccCBS(Space &home, bool share, GccCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+private:
+    // Set the capacities of the values, from the largest cardinality of every value of v
+    void init(Space &home, const IntArgs &v, const std::vector<int> &maxCard);
+
+    /**
+     * Remaining capacities, degrees of the variables in the replicated graph and effect of removing a replica of every
+     * value, left in the scratch memory. Returns the logarithm of the bound on the number of solutions.
+     */
+    double prepareDensities() const;
+
+    // Logarithm of the (unnormalized) bound of x[i] = val for every value of x[i], in increasing order of the values
+    void varBounds(int i) const;
+
+    // Best choice for the comparator Density
+    template<class Density>
+    CBSPosValDensity bestDensity() const;
+
+    // Memory of getDensity(), see GccCBS.cpp
+    struct DensityScratch;
+
+private:
+    // Smallest value and number of values of v, and capacity of every value (0 for the values not in v)
+    int _minVal;
+    int _nbVal;
+    int *_capacity;
+};
+
+#endif //CBS_GCCCBS_H
@@ -0,0 +1,296 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "LinearCBS.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+struct LinearCBS::DensityScratch {
+    // Densities of the values of the unassigned variables
+    std::vector<CBSPosValDensity> table;
+
+    /**
+     * Backward counts: the sums of x[j..] span [lo[j], lo[j] + width[j]) and their counts start at backward[start[j]].
+     * Every layer is scaled to a sum of 1.
+     */
+    std::vector<long long> lo, width, start;
+    std::vector<double> backward;
+    // Prefix sums of a backward layer, counts of the sums of x[j+1..] that satisfy the relation with a given sum, and
+    // the forward counts of x[0..j-1]
+    std::vector<double> prefix, satisfied, forward, nextForward;
+};
+
+LinearCBS::LinearCBS(Space &home, const IntArgs &a, const IntVarArgs &x, IntRelType irt, int c, int maxCells)
+        : CBSConstraint(home, x), _irt(irt), _c(c), _maxCells(maxCells) {
+    assert(a.size() == x.size());
+    _a = home.alloc<int>(a.size());
+    std::copy(a.begin(), a.end(), _a);
+
+    // Integer sums: < c is <= c - 1 and > c is >= c + 1.
+    if (_irt == IRT_LE) {
+        _irt = IRT_LQ;
+        _c--;
+    } else if (_irt == IRT_GR) {
+        _irt = IRT_GQ;
+        _c++;
+    }
+}
+
+LinearCBS::LinearCBS(Space &home, bool share, LinearCBS *c)
+        : CBSConstraint(home, share, c), _irt(c->_irt), _c(c->_c), _maxCells(c->_maxCells) {
+    _a = home.alloc<int>(_x.size());
+    std::copy(c->_a, c->_a + _x.size(), _a);
+}
+
+CBSConstraint *LinearCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(LinearCBS));
+    auto ret = new (mem) LinearCBS(home, share, static_cast<LinearCBS*>(c));
+    return ret;
+}
+
+CBSPosValDensity LinearCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    computeDensities();
+    return best(strategy, threadScratch<DensityScratch>().table);
+}
+
+double LinearCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    double logCount = computeDensities();
+    const auto &table = threadScratch<DensityScratch>().table;
+    densities.insert(densities.end(), table.begin(), table.end());
+    return logCount;
+}
+
+long long LinearCBS::termMin(int i) const {
+    return _a[i] >= 0 ? (long long)_a[i] * _x[i].min() : (long long)_a[i] * _x[i].max();
+}
+
+long long LinearCBS::termMax(int i) const {
+    return _a[i] >= 0 ? (long long)_a[i] * _x[i].max() : (long long)_a[i] * _x[i].min();
+}
+
+double LinearCBS::computeDensities() const {
+    threadScratch<DensityScratch>().table.clear();
+    double logCount;
+    if (!exactDensities(logCount))
+        logCount = approximateDensities();
+    return logCount;
+}
+
+bool LinearCBS::exactDensities(double &logCount) const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+    const int n = _x.size();
+
+    // Range of the sums of x[j..] for every j, which must all fit
+    s.lo.resize(n + 1);
+    s.width.resize(n + 1);
+    s.start.resize(n + 2);
+    s.lo[n] = 0;
+    s.width[n] = 1;
+    long long hi = 0, cells = 1;
+    for (int j = n - 1; j >= 0; j--) {
+        s.lo[j] = s.lo[j + 1] + termMin(j);
+        hi += termMax(j);
+        s.width[j] = hi - s.lo[j] + 1;
+        cells += s.width[j];
+        if (cells > _maxCells)
+            return false;
+    }
+    s.start[n] = 0;
+    for (int j = n; j > 0; j--)
+        s.start[j - 1] = s.start[j] + s.width[j];
+    s.backward.assign(s.start[0] + s.width[0], 0);
+
+    // Backward counts, from the empty suffix. The log of the scales is only needed for the whole sum.
+    double backwardLog = 0;
+    s.backward[s.start[n]] = 1;
+    for (int j = n - 1; j >= 0; j--) {
+        double *to = &s.backward[s.start[j]];
+        const double *from = &s.backward[s.start[j + 1]];
+        for (IntVarValues val((IntVar)_x[j]); val(); ++val) {
+            long long shift = s.lo[j + 1] + (long long)_a[j] * val.val() - s.lo[j];
+            for (long long t = 0; t < s.width[j + 1]; t++)
+                to[t + shift] += from[t];
+        }
+        double sum = 0;
+        for (long long t = 0; t < s.width[j]; t++)
+            sum += to[t];
+        for (long long t = 0; t < s.width[j]; t++)
+            to[t] /= sum;
+        backwardLog += std::log(sum);
+    }
+
+    // Number of solutions: the share of the sums of all the variables that satisfy the relation
+    double share = 0;
+    for (long long t = 0; t < s.width[0]; t++) {
+        long long sum = s.lo[0] + t;
+        bool ok = _irt == IRT_EQ ? sum == _c : _irt == IRT_NQ ? sum != _c : _irt == IRT_LQ ? sum <= _c : sum >= _c;
+        if (ok)
+            share += s.backward[s.start[0] + t];
+    }
+    logCount = share > 0 ? backwardLog + std::log(share) : -infinity;
+
+    // Forward counts of the sums of x[0..i-1], starting from the empty prefix
+    long long forwardLo = 0, forwardWidth = 1;
+    s.forward.assign(1, 1);
+    for (int i = 0; i < n; i++) {
+        /**
+         * satisfied[t] is the share of the sums of x[i+1..] that satisfy the relation once added to the sum lo + t of
+         * x[0..i], for every sum x[0..i] can reach. It is a prefix or suffix sum of the backward counts for the
+         * inequalities.
+         */
+        long long lo = forwardLo + termMin(i), width = forwardWidth + termMax(i) - termMin(i);
+        const double *backward = &s.backward[s.start[i + 1]];
+        const long long backwardWidth = s.width[i + 1];
+        s.prefix.resize(backwardWidth + 1);
+        s.prefix[0] = 0;
+        for (long long u = 0; u < backwardWidth; u++)
+            s.prefix[u + 1] = s.prefix[u] + backward[u];
+        s.satisfied.resize(width);
+        for (long long t = 0; t < width; t++) {
+            // Sum of x[i+1..] needed (or bound) for the relation, as an index of the backward layer
+            long long target = _c - (lo + t) - s.lo[i + 1];
+            double equal = target >= 0 && target < backwardWidth ? backward[target] : 0;
+            switch (_irt) {
+                case IRT_EQ:
+                    s.satisfied[t] = equal;
+                    break;
+                case IRT_NQ:
+                    s.satisfied[t] = 1 - equal;
+                    break;
+                case IRT_LQ:
+                    s.satisfied[t] = s.prefix[std::max(0LL, std::min(target + 1, backwardWidth))];
+                    break;
+                default:
+                    s.satisfied[t] = 1 - s.prefix[std::max(0LL, std::min(target, backwardWidth))];
+                    break;
+            }
+        }
+
+        if (!_x[i].assigned()) {
+            int first = s.table.size();
+            for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+                long long shift = forwardLo + (long long)_a[i] * val.val() - lo;
+                double weight = 0;
+                for (long long t = 0; t < forwardWidth; t++)
+                    weight += s.forward[t] * s.satisfied[t + shift];
+                s.table.push_back({i, val.val(), weight});
+            }
+            normalize(first);
+        }
+
+        // Next forward layer, scaled to a sum of 1
+        s.nextForward.assign(width, 0);
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            long long shift = forwardLo + (long long)_a[i] * val.val() - lo;
+            for (long long t = 0; t < forwardWidth; t++)
+                s.nextForward[t + shift] += s.forward[t];
+        }
+        double sum = 0;
+        for (double count : s.nextForward)
+            sum += count;
+        for (double &count : s.nextForward)
+            count /= sum;
+        std::swap(s.forward, s.nextForward);
+        forwardLo = lo;
+        forwardWidth = width;
+    }
+    return true;
+}
+
+double LinearCBS::approximateDensities() const {
+    const double infinity = std::numeric_limits<double>::infinity();
+    auto &s = threadScratch<DensityScratch>();
+
+    // Mean and variance of every term a[j] x[j], x[j] uniform over its domain, and of the whole sum
+    double mean = 0, variance = 0, logSize = 0;
+    for (int j = 0; j < _x.size(); j++) {
+        double m = 0, m2 = 0;
+        for (IntVarValues val((IntVar)_x[j]); val(); ++val) {
+            m += val.val();
+            m2 += (double)val.val() * val.val();
+        }
+        m /= _x[j].size();
+        m2 /= _x[j].size();
+        mean += _a[j] * m;
+        variance += (double)_a[j] * _a[j] * std::max(0.0, m2 - m * m);
+        logSize += std::log(_x[j].size());
+    }
+
+    // Probability that a sum of the given mean and variance satisfies the relation with r, with a continuity
+    // correction for the integer sums
+    auto probability = [this](double r, double mean, double variance) {
+        if (variance <= 0) {
+            bool ok = _irt == IRT_EQ ? r == mean : _irt == IRT_NQ ? r != mean : _irt == IRT_LQ ? mean <= r : mean >= r;
+            return ok ? 1.0 : 0.0;
+        }
+        double sd = std::sqrt(variance);
+        auto cdf = [](double z) { return 0.5 * std::erfc(-z / std::sqrt(2.0)); };
+        switch (_irt) {
+            case IRT_EQ:
+                return cdf((r + 0.5 - mean) / sd) - cdf((r - 0.5 - mean) / sd);
+            case IRT_NQ:
+                return 1 - (cdf((r + 0.5 - mean) / sd) - cdf((r - 0.5 - mean) / sd));
+            case IRT_LQ:
+                return cdf((r + 0.5 - mean) / sd);
+            default:
+                return 1 - cdf((r - 0.5 - mean) / sd);
+        }
+    };
+
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        double m = 0, m2 = 0;
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            m += val.val();
+            m2 += (double)val.val() * val.val();
+        }
+        m /= _x[i].size();
+        m2 /= _x[i].size();
+        double otherMean = mean - _a[i] * m;
+        double otherVariance = std::max(0.0, variance - (double)_a[i] * _a[i] * std::max(0.0, m2 - m * m));
+
+        int first = s.table.size();
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val)
+            s.table.push_back({i, val.val(), probability(_c - (double)_a[i] * val.val(), otherMean, otherVariance)});
+        normalize(first);
+    }
+
+    double p = probability(_c, mean, variance);
+    return p > 0 ? logSize + std::log(p) : -infinity;
+}
+
+void LinearCBS::normalize(int first) const {
+    auto &table = threadScratch<DensityScratch>().table;
+    double total = 0;
+    for (size_t k = first; k < table.size(); k++)
+        total += table[k].density;
+    for (size_t k = first; k < table.size(); k++)
+        table[k].density = densityOf(table[k].density, total);
+}
@@ -0,0 +1,79 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_LINEARCBS_H
+#define CBS_LINEARCBS_H
+
+#include <vector>
+#include "CBSConstraint.hpp"
+
+/**
+ * Linear couting base search constraint, the counterpart of Gecode's linear(home, a, x, irt, c): sum a[i] x[i] irt c.
+ *
+ * The solutions are counted exactly by dynamic programming over the partial sums, the number of assignments of
+ * x[0..i-1] for every sum (forward) and of x[i..] for every sum (backward), as long as all these sums fit in maxCells
+ * counts. Beyond that, the sum of the other variables is approximated by a normal distribution, the terms a[j] x[j]
+ * being independent and uniform over their domains.
+ */
+class LinearCBS : public CBSConstraint {
+public:
+    LinearCBS(Space &home, const IntArgs &a, const IntVarArgs &x, IntRelType irt, int c, int maxCells = 1 << 20);
+
+    LinearCBS(Space &home, bool share, LinearCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+private:
+    /**
+     * Density of every value of every unassigned variable, left in the scratch memory in the order of the variables
+     * and of their values. Returns the logarithm of the number of solutions.
+     */
+    double computeDensities() const;
+
+    // computeDensities() by dynamic programming, or false if the sums do not fit in _maxCells counts
+    bool exactDensities(double &logCount) const;
+
+    // computeDensities() from the normal approximation
+    double approximateDensities() const;
+
+    // Turn the weights of the values of x[i] (from first in the scratch memory) into densities
+    void normalize(int first) const;
+
+    // Smallest and largest value of a[i] x[i]
+    long long termMin(int i) const;
+    long long termMax(int i) const;
+
+    // Memory of getDensity(), see LinearCBS.cpp
+    struct DensityScratch;
+
+private:
+    int *_a;
+    // IRT_EQ, IRT_NQ, IRT_LQ or IRT_GQ: IRT_LE and IRT_GR are turned into IRT_LQ and IRT_GQ.
+    IntRelType _irt;
+    long long _c;
+    int _maxCells;
+};
+
+#endif //CBS_LINEARCBS_H
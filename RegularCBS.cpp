@@ -0,0 +1,230 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "RegularCBS.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+struct RegularCBS::DensityScratch {
+    // Values of a variable and their densities
+    std::vector<int> vals;
+    std::vector<double> densities;
+    // Densities of all the pairs, for getDensity()
+    std::vector<CBSPosValDensity> table;
+};
+
+RegularCBS::RegularCBS(Space &home, const IntVarArgs &x, const DFA &dfa)
+        : CBSConstraint(home, x), _nbStates(dfa.n_states()), _finalFst(dfa.final_fst()),
+          _finalLst(dfa.final_lst()) {
+    _minSymbol = dfa.symbol_min();
+    _nbSymbols = std::max(0, dfa.symbol_max() - _minSymbol + 1);
+    _symbolStart = home.alloc<int>(_nbSymbols + 1);
+    std::fill(_symbolStart, _symbolStart + _nbSymbols + 1, 0);
+    _transitions = home.alloc<Transition>(dfa.n_transitions());
+
+    // Bucket the transitions by symbol
+    for (DFA::Transitions t(dfa); t(); ++t)
+        _symbolStart[t.symbol() - _minSymbol + 1]++;
+    for (int s = 0; s < _nbSymbols; s++)
+        _symbolStart[s + 1] += _symbolStart[s];
+    std::vector<int> next(_symbolStart, _symbolStart + _nbSymbols);
+    for (DFA::Transitions t(dfa); t(); ++t)
+        _transitions[next[t.symbol() - _minSymbol]++] = {t.i_state(), t.o_state()};
+
+    int layers = (_x.size() + 1) * _nbStates;
+    _forward = home.alloc<double>(layers);
+    _backward = home.alloc<double>(layers);
+    _forwardLog = home.alloc<double>(_x.size() + 1);
+    _backwardLog = home.alloc<double>(_x.size() + 1);
+    _domSize = home.alloc<int>(_x.size());
+    std::fill(_domSize, _domSize + _x.size(), 0);
+
+    // The first and last layers never change: the start state, and the final states.
+    std::fill(_forward, _forward + _nbStates, 0);
+    _forward[0] = 1;
+    _forwardLog[0] = 0;
+    double *last = _backward + _x.size() * _nbStates;
+    std::fill(last, last + _nbStates, 0);
+    std::fill(last + _finalFst, last + _finalLst, 1.0 / (_finalLst - _finalFst));
+    _backwardLog[_x.size()] = std::log(_finalLst - _finalFst);
+}
+
+RegularCBS::RegularCBS(Space &home, bool share, RegularCBS *c)
+        : CBSConstraint(home, share, c), _nbStates(c->_nbStates), _minSymbol(c->_minSymbol),
+          _nbSymbols(c->_nbSymbols), _finalFst(c->_finalFst), _finalLst(c->_finalLst) {
+    int nbTransitions = c->_symbolStart[_nbSymbols];
+    _symbolStart = home.alloc<int>(_nbSymbols + 1);
+    std::copy(c->_symbolStart, c->_symbolStart + _nbSymbols + 1, _symbolStart);
+    _transitions = home.alloc<Transition>(nbTransitions);
+    std::copy(c->_transitions, c->_transitions + nbTransitions, _transitions);
+
+    int layers = (_x.size() + 1) * _nbStates;
+    _forward = home.alloc<double>(layers);
+    std::copy(c->_forward, c->_forward + layers, _forward);
+    _backward = home.alloc<double>(layers);
+    std::copy(c->_backward, c->_backward + layers, _backward);
+    _forwardLog = home.alloc<double>(_x.size() + 1);
+    std::copy(c->_forwardLog, c->_forwardLog + _x.size() + 1, _forwardLog);
+    _backwardLog = home.alloc<double>(_x.size() + 1);
+    std::copy(c->_backwardLog, c->_backwardLog + _x.size() + 1, _backwardLog);
+    _domSize = home.alloc<int>(_x.size());
+    std::copy(c->_domSize, c->_domSize + _x.size(), _domSize);
+}
+
+CBSConstraint *RegularCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(RegularCBS));
+    auto ret = new (mem) RegularCBS(home, share, static_cast<RegularCBS*>(c));
+    return ret;
+}
+
+CBSPosValDensity RegularCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    auto &table = threadScratch<DensityScratch>().table;
+    table.clear();
+    getDensities(table);
+    return best(strategy, table);
+}
+
+double RegularCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    updateCounts();
+    auto &s = threadScratch<DensityScratch>();
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        varDensities(i);
+        for (size_t k = 0; k < s.vals.size(); k++)
+            densities.push_back({i, s.vals[k], s.densities[k]});
+    }
+    return logCount();
+}
+
+double RegularCBS::densityBound(CBSStrategy strategy) {
+    if (strategy == MIN_BRANCHING)
+        return CBSMinDensity::best();
+    // The counts are updated incrementally, getDensity() reuses them.
+    updateCounts();
+    return productDensityBound(logCount());
+}
+
+void RegularCBS::updateCounts() {
+    int first = -1, last = -1;
+    for (int i = 0; i < _x.size(); i++) {
+        if (domainChanged(_domSize, i)) {
+            if (first < 0)
+                first = i;
+            last = i;
+        }
+    }
+    if (first < 0)
+        return;
+
+    for (int i = first; i < _x.size(); i++)
+        countForward(i);
+    for (int i = last; i >= 0; i--)
+        countBackward(i);
+}
+
+void RegularCBS::countForward(int i) {
+    const double *from = _forward + i * _nbStates;
+    double *to = _forward + (i + 1) * _nbStates;
+    std::fill(to, to + _nbStates, 0);
+    for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+        int s = val.val() - _minSymbol;
+        if (s < 0 || s >= _nbSymbols)
+            continue;
+        for (int t = _symbolStart[s]; t < _symbolStart[s + 1]; t++)
+            to[_transitions[t].to] += from[_transitions[t].from];
+    }
+
+    // Scaled to a sum of 1. Without any path left, the layer stays all zeros with a scale of -inf.
+    double sum = 0;
+    for (int q = 0; q < _nbStates; q++)
+        sum += to[q];
+    if (sum > 0) {
+        for (int q = 0; q < _nbStates; q++)
+            to[q] /= sum;
+        _forwardLog[i + 1] = _forwardLog[i] + std::log(sum);
+    } else {
+        _forwardLog[i + 1] = -std::numeric_limits<double>::infinity();
+    }
+}
+
+void RegularCBS::countBackward(int i) {
+    const double *from = _backward + (i + 1) * _nbStates;
+    double *to = _backward + i * _nbStates;
+    std::fill(to, to + _nbStates, 0);
+    for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+        int s = val.val() - _minSymbol;
+        if (s < 0 || s >= _nbSymbols)
+            continue;
+        for (int t = _symbolStart[s]; t < _symbolStart[s + 1]; t++)
+            to[_transitions[t].from] += from[_transitions[t].to];
+    }
+
+    double sum = 0;
+    for (int q = 0; q < _nbStates; q++)
+        sum += to[q];
+    if (sum > 0) {
+        for (int q = 0; q < _nbStates; q++)
+            to[q] /= sum;
+        _backwardLog[i] = _backwardLog[i + 1] + std::log(sum);
+    } else {
+        _backwardLog[i] = -std::numeric_limits<double>::infinity();
+    }
+}
+
+void RegularCBS::varDensities(int i) const {
+    auto &s = threadScratch<DensityScratch>();
+    s.vals.clear();
+    s.densities.clear();
+
+    // The scales of layers i and i + 1 are the same for all the values, they cancel out in the normalization.
+    const double *forward = _forward + i * _nbStates;
+    const double *backward = _backward + (i + 1) * _nbStates;
+    double total = 0;
+    for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+        double count = 0;
+        int sym = val.val() - _minSymbol;
+        if (sym >= 0 && sym < _nbSymbols)
+            for (int t = _symbolStart[sym]; t < _symbolStart[sym + 1]; t++)
+                count += forward[_transitions[t].from] * backward[_transitions[t].to];
+        s.vals.push_back(val.val());
+        s.densities.push_back(count);
+        total += count;
+    }
+
+    for (double &density : s.densities)
+        density = densityOf(density, total);
+}
+
+double RegularCBS::logCount() const {
+    const double *last = _forward + _x.size() * _nbStates;
+    double count = 0;
+    for (int q = _finalFst; q < _finalLst; q++)
+        count += last[q];
+    return count > 0 ? _forwardLog[_x.size()] + std::log(count) : -std::numeric_limits<double>::infinity();
+}
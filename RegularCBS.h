@@ -0,0 +1,101 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_REGULARCBS_H
+#define CBS_REGULARCBS_H
+
+#include <vector>
+#include "CBSConstraint.hpp"
+
+/**
+ * Regular couting base search constraint, the counterpart of Gecode's extensional(home, x, dfa): the sequence of the
+ * values of x is a word of the DFA.
+ *
+ * The densities are exact. The DFA is unfolded in a layered graph, layer i holding the states the automaton can be in
+ * before reading x[i]. The number of paths from the start state to every state of layer i (forward) and from every
+ * state of layer i to a final state of the last layer (backward) give the number of solutions with x[i] = v, the sum
+ * over the transitions on v from layer i to i + 1 of the product of the forward and backward counts at their ends.
+ */
+class RegularCBS : public CBSConstraint {
+public:
+    RegularCBS(Space &home, const IntVarArgs &x, const DFA &dfa);
+
+    RegularCBS(Space &home, bool share, RegularCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+    double densityBound(CBSStrategy strategy) override;
+
+private:
+    struct Transition {
+        int from;
+        int to;
+    };
+
+    /**
+     * Bring the counts up to date. Forward counts of layer i only depend on the variables before i, and backward counts
+     * only on the variables from i, so only the layers after the first changed variable (forward) and up to the last
+     * one (backward) are counted again.
+     */
+    void updateCounts();
+
+    // Count layer i + 1 forward from layer i, or layer i backward from layer i + 1
+    void countForward(int i);
+    void countBackward(int i);
+
+    // Density of every value of x[i], left in the scratch memory in increasing order of the values
+    void varDensities(int i) const;
+
+    // Logarithm of the number of solutions
+    double logCount() const;
+
+    // Memory of getDensity(), see RegularCBS.cpp
+    struct DensityScratch;
+
+private:
+    // Transitions of the DFA by symbol: the transitions on symbol s are _transitions[_symbolStart[s - _minSymbol]] to
+    // _transitions[_symbolStart[s - _minSymbol + 1] - 1]. States are numbered from 0, the start state.
+    int _nbStates;
+    int _minSymbol;
+    int _nbSymbols;
+    int *_symbolStart;
+    Transition *_transitions;
+    // The final states are _finalFst.._finalLst-1
+    int _finalFst;
+    int _finalLst;
+
+    /**
+     * Forward and backward counts of the (_x.size() + 1) layers, _nbStates per layer. To avoid overflows, every layer
+     * is scaled to a sum of 1, the logarithm of the scale being in _forwardLog and _backwardLog. They are copied with
+     * the space, along with the domain size of every variable when they were counted (0 before the first count).
+     */
+    double *_forward;
+    double *_backward;
+    double *_forwardLog;
+    double *_backwardLog;
+    int *_domSize;
+};
+
+#endif //CBS_REGULARCBS_H
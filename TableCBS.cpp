@@ -0,0 +1,214 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "TableCBS.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+struct TableCBS::DensityScratch {
+    // Union of the masks of a domain, for the words of the index
+    std::vector<Word> mask;
+    // Values of a variable and their densities
+    std::vector<int> vals;
+    std::vector<double> densities;
+    // Densities of all the pairs, for getDensity()
+    std::vector<CBSPosValDensity> table;
+};
+
+TableCBS::Supports::Supports(const ViewArray<Int::IntView> &x, const TupleSet &t)
+        : nbTuples(t.tuples()), nbWords((t.tuples() + bitsPerWord - 1) / bitsPerWord) {
+    assert(nbTuples == 0 || t.arity() == x.size());
+
+    // Without any tuple, no value has a mask and all the densities are 0.
+    if (nbTuples == 0) {
+        _minVal.assign(x.size(), 0);
+        _nbVal.assign(x.size(), 0);
+        _start.assign(x.size(), 0);
+        _maxSupport.assign(x.size(), 0);
+        return;
+    }
+
+    // Only the values in both the domain and a tuple get a mask.
+    int nbMasks = 0;
+    for (int i = 0; i < x.size(); i++) {
+        int minVal = std::numeric_limits<int>::max();
+        int maxVal = std::numeric_limits<int>::min();
+        for (int k = 0; k < nbTuples; k++) {
+            minVal = std::min(minVal, t[k][i]);
+            maxVal = std::max(maxVal, t[k][i]);
+        }
+        minVal = std::max(minVal, x[i].min());
+        maxVal = std::min(maxVal, x[i].max());
+        _minVal.push_back(minVal);
+        // The domain and the tuples may not overlap, the difference is computed without overflow
+        _nbVal.push_back((int)std::max(0LL, (long long)maxVal - minVal + 1));
+        _start.push_back(nbMasks);
+        nbMasks += _nbVal.back();
+    }
+
+    _masks.assign((size_t)nbMasks * nbWords, 0);
+    for (int k = 0; k < nbTuples; k++)
+        for (int i = 0; i < x.size(); i++) {
+            int v = t[k][i];
+            if (v >= _minVal[i] && v < _minVal[i] + _nbVal[i])
+                _masks[(size_t)(_start[i] + v - _minVal[i]) * nbWords + k / bitsPerWord] |= Word(1) << (k % bitsPerWord);
+        }
+
+    _maxSupport.assign(x.size(), 0);
+    for (int i = 0; i < x.size(); i++) {
+        for (int v = 0; v < _nbVal[i]; v++) {
+            const Word *mask = &_masks[(size_t)(_start[i] + v) * nbWords];
+            int support = 0;
+            for (int w = 0; w < nbWords; w++)
+                support += __builtin_popcountll(mask[w]);
+            _maxSupport[i] = std::max(_maxSupport[i], support);
+        }
+    }
+}
+
+TableCBS::TableCBS(Space &home, const IntVarArgs &x, const TupleSet &t)
+        : CBSConstraint(home, x), _supports(new Supports(_x, t)) {
+    const Supports &s = *_supports;
+    _words = home.alloc<Word>(s.nbWords);
+    _index = home.alloc<int>(s.nbWords);
+    _limit = s.nbWords;
+    for (int w = 0; w < s.nbWords; w++) {
+        _words[w] = ~Word(0);
+        _index[w] = w;
+    }
+    if (s.nbTuples % bitsPerWord != 0)
+        _words[s.nbWords - 1] = (Word(1) << (s.nbTuples % bitsPerWord)) - 1;
+
+    // The first update removes the tuples using values outside of the domains.
+    _domSize = home.alloc<int>(_x.size());
+    std::fill(_domSize, _domSize + _x.size(), 0);
+}
+
+TableCBS::TableCBS(Space &home, bool share, TableCBS *c)
+        : CBSConstraint(home, share, c), _limit(c->_limit) {
+    _supports.update(home, share, c->_supports);
+    int nbWords = (*_supports).nbWords;
+    _words = home.alloc<Word>(nbWords);
+    std::copy(c->_words, c->_words + nbWords, _words);
+    _index = home.alloc<int>(nbWords);
+    std::copy(c->_index, c->_index + nbWords, _index);
+    _domSize = home.alloc<int>(_x.size());
+    std::copy(c->_domSize, c->_domSize + _x.size(), _domSize);
+}
+
+CBSConstraint *TableCBS::copy(Space &home, bool share, CBSConstraint *c) {
+    char *mem = home.alloc<char>(sizeof(TableCBS));
+    auto ret = new (mem) TableCBS(home, share, static_cast<TableCBS*>(c));
+    return ret;
+}
+
+void TableCBS::dispose(Space &) {
+    _supports.~SupportsHandle();
+}
+
+CBSPosValDensity TableCBS::getDensity(CBSStrategy strategy) {
+    assert(!_x.assigned());
+
+    auto &table = threadScratch<DensityScratch>().table;
+    table.clear();
+    getDensities(table);
+    return best(strategy, table);
+}
+
+double TableCBS::getDensities(std::vector<CBSPosValDensity> &densities) {
+    assert(!_x.assigned());
+
+    updateTuples();
+    auto &s = threadScratch<DensityScratch>();
+    long long total = TableKernel::countAnd(_words, _words, _index, _limit);
+    for (int i = 0; i < _x.size(); i++) {
+        if (_x[i].assigned())
+            continue;
+        varDensities(i, total);
+        for (size_t k = 0; k < s.vals.size(); k++)
+            densities.push_back({i, s.vals[k], s.densities[k]});
+    }
+    return total > 0 ? std::log((double)total) : -std::numeric_limits<double>::infinity();
+}
+
+double TableCBS::densityBound(CBSStrategy strategy) {
+    if (strategy == MIN_BRANCHING)
+        return CBSMinDensity::best();
+    // The valid tuples are updated incrementally, getDensity() reuses them.
+    updateTuples();
+    long long total = TableKernel::countAnd(_words, _words, _index, _limit);
+    if (total == 0)
+        return 0;
+
+    /**
+     * A value has at most as many solutions as tuples in the table. The table may hold the same tuple more than once,
+     * which are counted as different solutions, so the product of the domain sizes does not bound them.
+     */
+    int support = 0;
+    for (int i = 0; i < _x.size(); i++)
+        if (!_x[i].assigned())
+            support = std::max(support, (*_supports).maxSupport(i));
+    return std::min(1.0, (double)support / total);
+}
+
+void TableCBS::updateTuples() {
+    const Supports &sup = *_supports;
+    auto &s = threadScratch<DensityScratch>();
+    for (int i = 0; i < _x.size(); i++) {
+        if (!domainChanged(_domSize, i))
+            continue;
+
+        // Tuples still valid for x[i], only over the words that are not zero yet
+        s.mask.assign(_limit, 0);
+        for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+            const Word *mask = sup.mask(i, val.val());
+            if (mask != nullptr)
+                for (int k = 0; k < _limit; k++)
+                    s.mask[k] |= mask[_index[k]];
+        }
+
+        // From the end, so a word that becomes zero is swapped with a word already seen
+        for (int k = _limit - 1; k >= 0; k--) {
+            Word &w = _words[_index[k]];
+            w &= s.mask[k];
+            if (w == 0)
+                std::swap(_index[k], _index[--_limit]);
+        }
+    }
+}
+
+void TableCBS::varDensities(int i, long long total) const {
+    const Supports &sup = *_supports;
+    auto &s = threadScratch<DensityScratch>();
+    s.vals.clear();
+    s.densities.clear();
+
+    // Every valid tuple takes one value of the domain of x[i].
+    for (IntVarValues val((IntVar)_x[i]); val(); ++val) {
+        const Word *mask = sup.mask(i, val.val());
+        long long count = mask == nullptr ? 0 : TableKernel::countAnd(_words, mask, _index, _limit);
+        s.vals.push_back(val.val());
+        s.densities.push_back(densityOf(count, total));
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_TABLECBS_H
+#define CBS_TABLECBS_H
+
+#include <vector>
+#include "CBSConstraint.hpp"
+#include "TableKernel.h"
+
+/**
+ * Table couting base search constraint, the counterpart of Gecode's extensional(home, x, t): the values of x are one
+ * of the tuples of t.
+ *
+ * The densities are exact. As in the compact-table propagator ("Compact-Table: Efficiently Filtering Table Constraints
+ * with Reversible Sparse Bit-Sets" by Demeulenaere et al.), the tuples whose values are all in the domains are the
+ * bits of a sparse bitset, copied with the space, and every value has a mask of the tuples where it appears. The number
+ * of solutions with x[i] = v is the popcount of the valid tuples and the mask of (i, v), computed by TableKernel.
+ */
+class TableCBS : public CBSConstraint {
+public:
+    TableCBS(Space &home, const IntVarArgs &x, const TupleSet &t);
+
+    TableCBS(Space &home, bool share, TableCBS *c);
+
+    CBSConstraint *copy(Space &home, bool share, CBSConstraint *c) override;
+
+    CBSPosValDensity getDensity(CBSStrategy strategy) override;
+
+    double getDensities(std::vector<CBSPosValDensity> &densities) override;
+
+    double densityBound(CBSStrategy strategy) override;
+
+    void dispose(Space &home) override;
+
+private:
+    typedef TableKernel::Word Word;
+    static const int bitsPerWord = 64;
+
+    // Masks of the values, built once when the constraint is posted and shared by all its copies
+    class Supports : public SharedHandle::Object {
+    public:
+        Supports(const ViewArray<Int::IntView> &x, const TupleSet &t);
+
+        SharedHandle::Object *copy() const override {
+            return new Supports(*this);
+        }
+
+        // Mask of the tuples where x[i] = v, or NULL if there are none
+        const Word *mask(int i, int v) const {
+            if (v < _minVal[i] || v >= _minVal[i] + _nbVal[i])
+                return nullptr;
+            return &_masks[(size_t)(_start[i] + v - _minVal[i]) * nbWords];
+        }
+
+        // Largest number of tuples of a value of x[i]
+        int maxSupport(int i) const {
+            return _maxSupport[i];
+        }
+
+        int nbTuples;
+        int nbWords;
+
+    private:
+        // Values of x[i] with a mask are _minVal[i].._minVal[i] + _nbVal[i] - 1, from the mask _start[i]
+        std::vector<int> _minVal;
+        std::vector<int> _nbVal;
+        std::vector<int> _start;
+        std::vector<Word> _masks;
+        std::vector<int> _maxSupport;
+    };
+
+    class SupportsHandle : public SharedHandle {
+    public:
+        SupportsHandle() {}
+
+        explicit SupportsHandle(Supports *s) : SharedHandle(s) {}
+
+        const Supports &operator*() const {
+            return *static_cast<const Supports *>(object());
+        }
+    };
+
+    // Remove from the valid tuples the ones using a value removed from a domain since the last update
+    void updateTuples();
+
+    // Density of every value of x[i], left in the scratch memory in increasing order of the values
+    void varDensities(int i, long long total) const;
+
+    // Memory of getDensity(), see TableCBS.cpp
+    struct DensityScratch;
+
+private:
+    SupportsHandle _supports;
+
+    /**
+     * Valid tuples. The words that are not zero are _words[_index[0]] to _words[_index[_limit - 1]], the words at the
+     * end of _index are zero. Copied with the space, along with the domain size of every variable at the last update (0
+     * before the first one).
+     */
+    Word *_words;
+    int *_index;
+    int _limit;
+    int *_domSize;
+};
+
+#endif //CBS_TABLECBS_H
@@ -0,0 +1,125 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include "TableKernel.h"
+
+// Vectorized versions are only compiled for x86 with a compiler that can target an instruction set per function.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CBS_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace TableKernel {
+
+    typedef long long (*Kernel)(const Word *, const Word *, const int *, int);
+
+    /*******************************************************************************************************************
+     * Scalar version
+     ******************************************************************************************************************/
+
+    static inline int popcount(Word w) {
+        int n = 0;
+        for (; w != 0; n++)
+            w &= w - 1;
+        return n;
+    }
+
+    static long long countAndScalar(const Word *a, const Word *b, const int *index, int n) {
+        long long count = 0;
+        for (int k = 0; k < n; k++)
+            count += popcount(a[index[k]] & b[index[k]]);
+        return count;
+    }
+
+#ifdef CBS_KERNEL_X86
+    /*******************************************************************************************************************
+     * POPCNT version, one word at a time with the popcnt instruction
+     ******************************************************************************************************************/
+
+    __attribute__((target("popcnt")))
+    static long long countAndPopcnt(const Word *a, const Word *b, const int *index, int n) {
+        long long count = 0;
+        for (int k = 0; k < n; k++)
+            count += __builtin_popcountll(a[index[k]] & b[index[k]]);
+        return count;
+    }
+
+    /*******************************************************************************************************************
+     * AVX-512 version, 8 words gathered through the index at a time
+     ******************************************************************************************************************/
+
+    __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+    static long long countAndAVX512(const Word *a, const Word *b, const int *index, int n) {
+        __m512i acc = _mm512_setzero_si512();
+        int k = 0;
+        for (; k + 8 <= n; k += 8) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + k));
+            __m512i wa = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), 0xFF, idx, a, 8);
+            __m512i wb = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), 0xFF, idx, b, 8);
+            acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_and_si512(wa, wb)));
+        }
+        long long lanes[8];
+        _mm512_storeu_si512(lanes, acc);
+        long long count = 0;
+        for (long long lane : lanes)
+            count += lane;
+        for (; k < n; k++)
+            count += __builtin_popcountll(a[index[k]] & b[index[k]]);
+        return count;
+    }
+#endif
+
+    /*******************************************************************************************************************
+     * Runtime dispatch
+     ******************************************************************************************************************/
+
+    struct Dispatch {
+        Kernel kernel;
+        const char *name;
+
+        Dispatch() : kernel(countAndScalar), name("scalar") {
+#ifdef CBS_KERNEL_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) {
+                kernel = countAndAVX512;
+                name = "avx512vpopcntdq";
+            } else if (__builtin_cpu_supports("popcnt")) {
+                kernel = countAndPopcnt;
+                name = "popcnt";
+            }
+#endif
+        }
+    };
+
+    // Initialized once, the first time the kernel is used (thread-safe since C++11)
+    static const Dispatch &dispatch() {
+        static const Dispatch d;
+        return d;
+    }
+
+    long long countAnd(const Word *a, const Word *b, const int *index, int n) {
+        return dispatch().kernel(a, b, index, n);
+    }
+
+    const char *isa() {
+        return dispatch().name;
+    }
+}
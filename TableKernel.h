@@ -0,0 +1,43 @@
+/*
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be
+ *  included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#ifndef CBS_TABLEKERNEL_H
+#define CBS_TABLEKERNEL_H
+
+/**
+ * Popcount kernel of TableCBS.
+ *
+ * The valid tuples of a TableCBS are the bits of a sparse bitset, whose words that are not zero are listed in an
+ * index. The kernel counts the bits set in both a and b over the n words index[0..n-1], so the number of valid tuples
+ * supporting a value is one call with the support mask of the value. The instruction set (AVX-512 VPOPCNTDQ, POPCNT or
+ * plain scalar code) is picked once at runtime from what the processor supports. All of them give the same results.
+ */
+namespace TableKernel {
+    typedef unsigned long long Word;
+
+    // Number of bits set in a[index[k]] & b[index[k]] for k from 0 to n-1
+    long long countAnd(const Word *a, const Word *b, const int *index, int n);
+
+    // Name of the instruction set used by countAnd()
+    const char *isa();
+}
+
+#endif //CBS_TABLEKERNEL_H
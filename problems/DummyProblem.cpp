@@ -4,6 +4,7 @@
 
 #include "../CBSBrancher.h"
 #include "../AllDiffCBS.h"
+#include "../LinearCBS.h"
 
 using namespace Gecode;
 
@@ -11,23 +12,30 @@ class DummyProblem : public IntMaximizeSpace {
 protected:
     IntVarArray l1, l2;
     IntVar maximize_this;
+    // Largest value of maximize_this, 9, 8 and 7 on the largest coefficients of both lists. The objective is a term of
+    // the LinearCBS constraint, so the brancher must not get it with an unbounded domain.
+    static const int maxObjective = 2 * (10 * 9 + 9 * 8 + 8 * 7);
 public:
     DummyProblem(void)
             : l1(*this, 3, 0, 9),
               l2(*this, 3, 0, 9),
-              maximize_this(*this, 0, 100000) {
+              maximize_this(*this, 0, maxObjective) {
         distinct(*this, l1);
         distinct(*this, l2);
 
         rel(*this, maximize_this == 10 * l1[0] + 9 * l1[1] + 8 * l1[2]
                                     + 10 * l2[0] + 9 * l2[1] + 8 * l2[2]);
 
+        IntVarArgs terms;
+        terms << l1 << l2 << maximize_this;
+
         std::vector<CBSConstraint*> constraints{
                 new AllDiffCBS(*this, l1),
-                new AllDiffCBS(*this, l2)
+                new AllDiffCBS(*this, l2),
+                new LinearCBS(*this, IntArgs(7, 10, 9, 8, 10, 9, 8, -1), terms, IRT_EQ, 0)
         };
 
-        cbsbranch(*this, constraints, std::greater<double>());
+        cbsbranch(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING);
     }
 
     DummyProblem(bool share, DummyProblem &s)
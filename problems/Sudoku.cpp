@@ -37,6 +37,10 @@
 
 #include "../CBSBrancher.h"
 #include "../AllDiffCBS.h"
+#include "../GccCBS.h"
+#include "../CBSDensityCache.h"
+#include "../CBSDensityProvider.h"
+#include "../CBSLDS.hpp"
 
 using namespace Gecode;
 
@@ -67,7 +71,18 @@ public:
         BRANCH_SIZE_DEGREE, ///< Use minimum size over degree
         BRANCH_SIZE_AFC,    ///< Use minimum size over afc
         BRANCH_AFC,         ///< Use maximum afc
-        BRANCH_CBS          ///< Use couting base search
+        BRANCH_CBS,         ///< Use couting base search (maxSD)
+        BRANCH_CBS_MAXRELSD, ///< Use couting base search (maxRelSD)
+        BRANCH_CBS_AAVGSD,  ///< Use couting base search (aAvgSD)
+        BRANCH_CBS_WSCOUNTING, ///< Use couting base search (wSCounting)
+        BRANCH_CBS_VAR,     ///< Use maximum density for the variable, minimum value
+        BRANCH_CBS_VAL,     ///< Use maximum afc over size for the variable, maximum density for the value
+        BRANCH_CBS_RND      ///< Use couting base search (maxSD), random ties and softmax values, for restarts
+    };
+    // Search variants
+    enum {
+        SEARCH_DFS, ///< Use depth first search
+        SEARCH_LDS  ///< Use limited discrepancy search over the densities
     };
 
     /// Constructor
@@ -80,10 +95,12 @@ public:
 
 };
 
-class SudokuInt : virtual public Sudoku {
+class SudokuInt : virtual public Sudoku, public CBSDensityProvider {
 protected:
     /// Values for the fields
     IntVarArray x;
+    /// Counting base search constraints of the model, for the branching (empty in the clones)
+    std::vector<CBSConstraint*> constraints;
 public:
 #ifdef GECODE_HAS_SET_VARS
     /// Propagation variantS
@@ -92,15 +109,14 @@ public:
         PROP_SAME, ///< Use "same" constraint with integer model
     };
 #endif
-    /// Constructor
-    SudokuInt(const SizeOptions& opt)
+    /// Constructor, the branching is posted by postBranching() if \a branching is false
+    SudokuInt(const SizeOptions& opt, bool branching = true)
             : Sudoku(opt), x(*this, n*n*n*n, 1, n*n) {
         const int nn = n*n;
         Matrix<IntVarArray> m(x, nn, nn);
 
         // For each constraint, we must create the approriate brancher if we want
         // to use constraint base search
-        std::vector<CBSConstraint*> constraints;
 
         auto newAllDiff = [&](auto arr) {
             char *mem = alloc<char>(sizeof(AllDiffCBS));
@@ -173,6 +189,33 @@ public:
             }
         }
 #endif
+        if (branching)
+            postBranching(opt);
+    }
+
+    /// Constructor for cloning \a s
+    SudokuInt(bool share, SudokuInt& s) : Sudoku(share, s), CBSDensityProvider(*this, share, s) {
+        x.update(*this, share, s.x);
+    }
+
+protected:
+    /// Whether the branching of \a opt uses the counting base search constraints
+    static bool cbsBranching(const SizeOptions& opt) {
+        return opt.branching() >= BRANCH_CBS;
+    }
+
+    /// Options of the counting base search branchings of \a opt
+    static CBSOptions cbsOptions(const SizeOptions& opt) {
+        CBSOptions options;
+        // -threads, resolved like the threads of the search engines (0 for all the processing units)
+        Search::Options search;
+        search.threads = opt.threads();
+        options.threads = search.expand().threads;
+        return options;
+    }
+
+    /// Post the branching of \a opt
+    void postBranching(const SizeOptions& opt) {
         if (opt.branching() == BRANCH_NONE) {
             branch(*this, x, INT_VAR_NONE(), INT_VAL_SPLIT_MIN());
         } else if (opt.branching() == BRANCH_SIZE) {
@@ -184,15 +227,29 @@ public:
         } else if (opt.branching() == BRANCH_AFC) {
             branch(*this, x, INT_VAR_AFC_MAX(opt.decay()), INT_VAL_SPLIT_MIN());
         } else if (opt.branching() == BRANCH_CBS) {
-            cbsbranch(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING);
+            cbsbranch(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING, cbsOptions(opt));
+        } else if (opt.branching() == BRANCH_CBS_MAXRELSD) {
+            cbsbranch(*this, constraints, CBSBrancher::Strategy::MAXRELSD_BRANCHING, cbsOptions(opt));
+        } else if (opt.branching() == BRANCH_CBS_AAVGSD) {
+            cbsbranch(*this, constraints, CBSBrancher::Strategy::AAVGSD_BRANCHING, cbsOptions(opt));
+        } else if (opt.branching() == BRANCH_CBS_WSCOUNTING) {
+            cbsbranch(*this, constraints, CBSBrancher::Strategy::WSCOUNTING_BRANCHING, cbsOptions(opt));
+        } else if (opt.branching() == BRANCH_CBS_VAR) {
+            cbsConstraints(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING);
+            branch(*this, x, INT_VAR_MERIT_MAX(&cbsmerit), INT_VAL_MIN());
+        } else if (opt.branching() == BRANCH_CBS_VAL) {
+            cbsConstraints(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING);
+            branch(*this, x, INT_VAR_AFC_SIZE_MAX(opt.decay()), INT_VAL(&cbsval));
+        } else if (opt.branching() == BRANCH_CBS_RND) {
+            CBSOptions options = cbsOptions(opt);
+            options.randomTies = true;
+            options.temperature = 0.05;
+            options.seed = opt.seed();
+            cbsbranch(*this, constraints, CBSBrancher::Strategy::MAX_BRANCHING, options);
         }
     }
 
-    /// Constructor for cloning \a s
-    SudokuInt(bool share, SudokuInt& s) : Sudoku(share, s) {
-        x.update(*this, share, s.x);
-    }
-
+public:
     /// Perform copying during cloning
     virtual Space*
     copy(bool share) {
@@ -356,7 +413,7 @@ class SudokuMixed : public SudokuInt, public SudokuSet {
 public:
     /// Constructor
     SudokuMixed(const SizeOptions& opt)
-            : Sudoku(opt), SudokuInt(opt), SudokuSet(opt) {
+            : Sudoku(opt), SudokuInt(opt, !cbsBranching(opt)), SudokuSet(opt) {
         const int nn = n*n;
 
         IntSet is0(0,0);
@@ -377,6 +434,13 @@ public:
         for (int i=nn; i--;)
             values[i] = i+1;
         count(*this, x, IntSet(nn,nn), values, ICL_DOM);
+
+        // The counting base search branchings also count on the cardinality constraint
+        if (cbsBranching(opt)) {
+            char *mem = alloc<char>(sizeof(GccCBS));
+            constraints.push_back(new (mem) GccCBS(*this, x, IntSet(nn,nn), values));
+            postBranching(opt);
+        }
     }
 
     /// Constructor for cloning \a s
@@ -396,6 +460,40 @@ public:
 
 #endif
 
+/// Run \a S with the search of \a opt, and print its solutions and statistics
+template<class S>
+void
+run(const SizeOptions& opt) {
+    if (opt.search() == Sudoku::SEARCH_DFS) {
+        Script::run<S,DFS,SizeOptions>(opt);
+        return;
+    }
+
+    Support::Timer t;
+    t.start();
+    S* s = new S(opt);
+    CBSLDS<S> e(s);
+    delete s;
+    unsigned int n = 0;
+    while (n != opt.solutions() || opt.solutions() == 0) {
+        S* solution = e.next();
+        if (solution == NULL)
+            break;
+        solution->print(std::cout);
+        delete solution;
+        n++;
+    }
+    Search::Statistics stat = e.statistics();
+    std::cout << std::endl
+              << "Summary" << std::endl
+              << "\truntime:      " << t.stop() << " ms" << std::endl
+              << "\tsolutions:    " << n << std::endl
+              << "\tnodes:        " << stat.node << std::endl
+              << "\tfailures:     " << stat.fail << std::endl
+              << "\titerations:   " << stat.restart + 1 << std::endl
+              << "\tpeak depth:   " << stat.depth << std::endl;
+}
+
 int
 main(int argc, char* argv[]) {
     SizeOptions opt("Sudoku");
@@ -420,6 +518,20 @@ main(int argc, char* argv[]) {
     opt.branching(Sudoku::BRANCH_SIZE_AFC, "sizeafc", "min size over afc");
     opt.branching(Sudoku::BRANCH_AFC, "afc", "maximum afc");
     opt.branching(Sudoku::BRANCH_CBS, "cbs", "counting base search. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_MAXRELSD, "cbsmaxrelsd", "counting base search, maxRelSD. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_AAVGSD, "cbsaavgsd", "counting base search, aAvgSD. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_WSCOUNTING, "cbswscounting",
+                  "counting base search, wSCounting. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_VAR, "cbsvar",
+                  "maximum density variable, min value. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_VAL, "cbsval",
+                  "min size over afc variable, maximum density value. Only for integer constraints.");
+    opt.branching(Sudoku::BRANCH_CBS_RND, "cbsrnd",
+                  "counting base search, random ties and values. Use with -restart. Only for integer constraints.");
+    opt.search(Sudoku::SEARCH_DFS);
+    opt.search(Sudoku::SEARCH_DFS, "dfs", "depth first search");
+    opt.search(Sudoku::SEARCH_LDS, "lds",
+               "limited discrepancy search over the densities of the cbs branchings, no restarts");
     opt.parse(argc,argv);
     if (opt.size() >= n_examples) {
         std::cerr << "Error: size must be between 0 and "
@@ -430,19 +542,27 @@ main(int argc, char* argv[]) {
 #ifdef GECODE_HAS_SET_VARS
     switch (opt.model()) {
         case Sudoku::MODEL_INT:
-            Script::run<SudokuInt,DFS,SizeOptions>(opt);
+            run<SudokuInt>(opt);
             break;
         case Sudoku::MODEL_SET:
-            Script::run<SudokuSet,DFS,SizeOptions>(opt);
+            run<SudokuSet>(opt);
             break;
         case Sudoku::MODEL_MIXED:
-            Script::run<SudokuMixed,DFS,SizeOptions>(opt);
+            run<SudokuMixed>(opt);
             break;
     }
 #else
-    Script::run<SudokuInt,DFS,SizeOptions>(opt);
+    run<SudokuInt>(opt);
 #endif
 
+    // Only CBSBrancher uses the density cache, not the merit and value functions of cbsvar and cbsval.
+    bool cbsBrancher = opt.branching() >= Sudoku::BRANCH_CBS && opt.branching() != Sudoku::BRANCH_CBS_VAR &&
+                       opt.branching() != Sudoku::BRANCH_CBS_VAL;
+    if (cbsBrancher) {
+        CBSDensityCache::Statistics stats = CBSDensityCache::statistics();
+        std::cout << "\tdensity cache: " << stats.hits << " hits, " << stats.misses << " misses" << std::endl;
+    }
+
     return 0;
 }
 